@@ -15,6 +15,9 @@ Application::Application()
 	box_editor.set_bounding_box(_sim.bounding_box);
 	box_editor.set_emitters(_sim.emitters);
 	box_editor.set_particle_system(_sim.particle_system);
+
+	// read by particle_bin.vert; adding SURFACE_FLAGS highlights the surface particles (BIN_INDEX is not read)
+	_sim.derived_fields.register_interest(PARTICLE_COLOR);
 }
 
 void Application::paint(void)
@@ -0,0 +1,31 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * How values of an AttributeChannel are indexed:
+ * SORTED	by slot in ParticleSystem::particles; permuted together with particles by the sort step
+ * SCRATCH	by slot, but rewritten every step before being read - never permuted
+ * BY_ID	by Particle::id; never moved (see ParticleSystem::get_slot()); grows with every particle ever added, ids are not reused
+ */
+enum class ChannelLayout { SORTED, SCRATCH, BY_ID };
+
+/**
+ * Per-particle data kept outside of Particle (nutrients, temperature, species, tags...),
+ * so neighbour loops of the core SPH passes only stream positions/velocities/densities.
+ * name	unique, used for lookup (ParticleSystem::find_channel())
+ * no_components	floats per particle
+ * values	[index * no_components + component]; new slots/ids start at 0
+ * initialize	optional; fills no_components values of a particle added by ParticleSystem::add_particle()
+ */
+struct AttributeChannel
+{
+	using Initializer = std::function<void(int id, float * values)>;
+
+	std::string name;
+	int no_components;
+	ChannelLayout layout;
+	std::vector<float> values;
+	Initializer initialize;
+};
@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "BoundarySDF.hpp"
+#include "BoundaryParticles.hpp"
+
+
+BoundaryParticles::BoundaryParticles()
+{
+	cells.fill({ 0, 0 });
+}
+
+void BoundaryParticles::sample_from_sdf(BoundarySDF const & sdf)
+{
+	using particle_system::out_of_grid_scope;
+
+	float const spacing = c::boundary_particle_spacing;
+	particles.clear();
+
+	// lattice points within half a spacing of the surface, projected onto it; 2D: only the z = 0 plane
+	float const z_first = c::dimensions == 3 ? c::zmin + 0.5f*spacing : 0.0f;
+	float const z_end = c::dimensions == 3 ? c::zmax : spacing;
+	for(float z = z_first; z < z_end; z += spacing)
+		for(float y = c::ymin + 0.5f*spacing; y < c::ymax; y += spacing)
+			for(float x = c::xmin + 0.5f*spacing; x < c::xmax; x += spacing)
+			{
+				float distance;
+				glm::vec3 normal;
+				sdf.sample(glm::vec3(x, y, z), distance, normal);
+
+				if(fabs(distance) >= 0.5f*spacing)
+					continue;
+
+				glm::vec3 const on_surface = dimension::pin(glm::vec3(x, y, z) - distance*normal);
+				if(!out_of_grid_scope(on_surface))
+					particles.push_back({ on_surface, 0.0f });
+			}
+
+	bin_particles();
+	compute_volumes();
+}
+
+void BoundaryParticles::bin_particles()
+{
+	using particle_system::get_cell_index;
+
+	// boundary never moves: sort once
+	std::stable_sort(particles.begin(), particles.end(), [](BoundaryParticle const & a, BoundaryParticle const & b)
+	{
+		return get_cell_index(a.position) < get_cell_index(b.position);
+	});
+
+	cells.fill({ 0, 0 });
+	for(int b = 0; b < static_cast<int>(particles.size()); ++b)
+	{
+		auto & cell = cells[get_cell_index(particles[b].position)];
+		if(cell.no_particles == 0)
+			cell.first = b;
+		++cell.no_particles;
+	}
+}
+
+void BoundaryParticles::compute_volumes()
+{
+	float const h_sq = c::H*c::H;
+	float const coefficient = dimension::Current::poly6(c::H);// W_poly6
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < static_cast<int>(particles.size()); ++b)
+	{
+		auto & boundary_particle = particles[b];
+		float kernel_sum = 0.0f;
+
+		for_each_neighbour(boundary_particle.position, c::H, [&](BoundaryParticle const &, glm::vec3 const rVec, float const)
+		{
+			kernel_sum += coefficient * pow(h_sq - glm::dot(rVec, rVec), 3);
+		});
+
+		// kernel_sum includes the particle itself, never 0
+		boundary_particle.volume = 1.0f / kernel_sum;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "Dimension.hpp"
+#include "MathTier.hpp"
+#include "Grid.hpp"
+#include "ParticleSystem.hpp"
+
+class BoundarySDF;
+
+/**
+ * Static particle sampled on a solid surface.
+ * volume	Akinci et al. 2012 "Versatile Rigid-Fluid Coupling for Incompressible SPH":
+ 	V_b = 1 / sum_k W(x_b - x_k) over boundary neighbours; corrects for uneven sampling.
+ */
+struct BoundaryParticle
+{
+	glm::vec3 position;
+	float volume;
+};
+
+// boundary particles of one grid cell: [first, first + no_particles) in BoundaryParticles::particles
+struct BoundaryCell
+{
+	int first;
+	int no_particles;
+};
+
+/**
+ * Single layer of boundary particles on container walls and obstacles,
+ * sorted and binned once into their own grid (same cells as Grid).
+ * Fluid particles see them as neighbours with mass restDensity * volume,
+ * so walls contribute to density and pressure instead of penalty springs.
+ */
+class BoundaryParticles
+{
+public:
+	BoundaryParticles();
+
+	/**
+	 * Places particles on the zero level set of the boundary distance field
+	 * (every obstacle in the field gets sampled), then bins them and computes volumes.
+	 */
+	void sample_from_sdf(BoundarySDF const & sdf);
+
+	/**
+	 * Calls f(boundary_particle, rVec, r) for every boundary particle closer than radius to position.
+	 * rVec = position - boundary_particle.position
+	 */
+	template<typename NeighbourFunction>
+	void for_each_neighbour(glm::vec3 const position, float const radius, NeighbourFunction f) const;
+
+	std::vector<BoundaryParticle> const & get_particles() const { return particles; }
+
+private:
+	void bin_particles();
+	void compute_volumes();
+
+	std::vector<BoundaryParticle> particles;// sorted by cell index
+	std::array<BoundaryCell, c::C> cells;
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename NeighbourFunction>
+void BoundaryParticles::for_each_neighbour(glm::vec3 const position, float const radius, NeighbourFunction f) const
+{
+	using particle_system::get_cell_index;
+	using particle_system::out_of_grid_scope;
+	using particle_system::wrap_position;
+	using particle_system::minimum_image;
+
+	glm::ivec3 const reach = Grid::get_reach(radius);
+	for(int z = -reach.z; z <= reach.z; ++z)
+	{
+		for(int y = -reach.y; y <= reach.y; ++y)
+		{
+			for(int x = -reach.x; x <= reach.x; ++x)
+			{
+				glm::vec3 neighbour_cell_vector = wrap_position(position + glm::vec3(x*c::dx, y*c::dy, z*c::dz));
+				if(out_of_grid_scope(neighbour_cell_vector))
+					continue;
+
+				auto const & cell = cells[get_cell_index(neighbour_cell_vector)];
+				for(int b = cell.first; b < cell.first + cell.no_particles; ++b)
+				{
+					auto const & boundary_particle = particles[b];
+					glm::vec3 const rVec = minimum_image(position - boundary_particle.position);
+					float const r_sq = glm::dot(rVec, rVec);
+
+					if(r_sq > radius*radius)
+						continue;
+
+					f(boundary_particle, rVec, math_tier::Current::sqrt(r_sq));
+				}
+			}
+		}
+	}
+}
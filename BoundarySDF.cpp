@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <sstream>
+
+#include "BoundarySDF.hpp"
+
+
+namespace
+{
+	// signed distance to an axis aligned box, negative inside
+	float box_distance(glm::vec3 const p, glm::vec3 const min_corner, glm::vec3 const max_corner)
+	{
+		glm::vec3 const center = 0.5f * (min_corner + max_corner);
+		glm::vec3 const q = glm::abs(p - center) - 0.5f * (max_corner - min_corner);
+		float const outside = glm::length(glm::max(q, glm::vec3(0.0f)));
+		float const inside = glm::min(glm::max(q.x, glm::max(q.y, q.z)), 0.0f);
+		return outside + inside;
+	}
+
+	// Christer Ericson, "Real-Time Collision Detection", 5.1.5
+	glm::vec3 closest_point_on_triangle(glm::vec3 const p, glm::vec3 const a, glm::vec3 const b, glm::vec3 const c)
+	{
+		glm::vec3 const ab = b - a, ac = c - a, ap = p - a;
+		float const d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+		if(d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		glm::vec3 const bp = p - b;
+		float const d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+		if(d3 >= 0.0f && d4 <= d3)
+			return b;
+
+		float const vc = d1*d4 - d3*d2;
+		if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+
+		glm::vec3 const cp = p - c;
+		float const d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+		if(d6 >= 0.0f && d5 <= d6)
+			return c;
+
+		float const vb = d5*d2 - d1*d6;
+		if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+
+		float const va = d3*d6 - d5*d4;
+		if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		float const denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+}
+
+BoundarySDF::BoundarySDF() : BoundarySDF(glm::vec3(c::xmin, c::ymin, c::zmin) - glm::vec3(c::H), glm::vec3(c::xmax, c::ymax, c::zmax) + glm::vec3(c::H))
+{
+}
+
+BoundarySDF::BoundarySDF(glm::vec3 const min_corner, glm::vec3 const max_corner)
+{
+	spacing = c::sdf_spacing;
+	origin = min_corner;
+	glm::vec3 const extent = max_corner - min_corner;
+	dims = glm::ivec3(static_cast<int>(ceil(extent.x / spacing)) + 1, static_cast<int>(ceil(extent.y / spacing)) + 1, static_cast<int>(ceil(extent.z / spacing)) + 1);
+
+	// no boundaries at all until something is added
+	distance.assign(dims.x * dims.y * dims.z, 1.0e6f);
+}
+
+void BoundarySDF::set_container_box(glm::vec3 const min_corner, glm::vec3 const max_corner)
+{
+	merge_obstacle([&](glm::vec3 const p) { return -box_distance(p, min_corner, max_corner); });
+}
+
+void BoundarySDF::add_box_obstacle(glm::vec3 const min_corner, glm::vec3 const max_corner)
+{
+	merge_obstacle([&](glm::vec3 const p) { return box_distance(p, min_corner, max_corner); });
+}
+
+void BoundarySDF::add_sphere_obstacle(glm::vec3 const center, float const radius)
+{
+	merge_obstacle([&](glm::vec3 const p) { return glm::length(p - center) - radius; });
+}
+
+void BoundarySDF::add_triangle_mesh_obstacle(std::vector<glm::vec3> const & vertices, std::vector<unsigned> const & indices)
+{
+	int const no_samples = dims.x * dims.y * dims.z;
+	int const no_triangles = static_cast<int>(indices.size() / 3);
+	// beyond the band the exact distance does not matter (no force further than c::H from a wall)
+	float const band = c::H + 2.0f * spacing;
+	std::vector<float> unsigned_distance(no_samples, band);
+
+	// 1. unsigned distance in a narrow band: every triangle only visits samples in its expanded AABB
+	for(int t = 0; t < no_triangles; ++t)
+	{
+		glm::vec3 const a = vertices[indices[3*t]], b = vertices[indices[3*t + 1]], c = vertices[indices[3*t + 2]];
+		glm::ivec3 const lo = glm::max(glm::ivec3(glm::floor((glm::min(a, glm::min(b, c)) - glm::vec3(band) - origin) / spacing)), glm::ivec3(0));
+		glm::ivec3 const hi = glm::min(glm::ivec3(glm::floor((glm::max(a, glm::max(b, c)) + glm::vec3(band) - origin) / spacing)) + glm::ivec3(1), dims - glm::ivec3(1));
+
+		#pragma omp parallel for schedule(static)
+		for(int z = lo.z; z <= hi.z; ++z)
+			for(int y = lo.y; y <= hi.y; ++y)
+				for(int x = lo.x; x <= hi.x; ++x)
+				{
+					glm::vec3 const p = get_sample_position(x, y, z);
+					float & d = unsigned_distance[get_sample_index(x, y, z)];
+					d = glm::min(d, glm::length(p - closest_point_on_triangle(p, a, b, c)));
+				}
+	}
+
+	// 2. sign by ray parity: one ray along +x per (y, z) row, crossings shared by the whole row
+	#pragma omp parallel for schedule(dynamic)
+	for(int z = 0; z < dims.z; ++z)
+	{
+		std::vector<float> crossings;
+		for(int y = 0; y < dims.y; ++y)
+		{
+			// ray nudged off the lattice: axis aligned meshes would otherwise be hit exactly on edges
+			glm::vec3 const row = get_sample_position(0, y, z) + glm::vec3(0.0f, 1.37e-3f, 2.91e-3f) * spacing;
+			crossings.clear();
+
+			for(int t = 0; t < no_triangles; ++t)
+			{
+				glm::vec3 const a = vertices[indices[3*t]], b = vertices[indices[3*t + 1]], c = vertices[indices[3*t + 2]];
+				// barycentric coordinates of the row in the triangle projected on the yz plane
+				float const det = (b.y - a.y) * (c.z - a.z) - (c.y - a.y) * (b.z - a.z);
+				if(fabs(det) < FLT_EPSILON)
+					continue;
+
+				float const u = ((row.y - a.y) * (c.z - a.z) - (c.y - a.y) * (row.z - a.z)) / det;
+				float const v = ((b.y - a.y) * (row.z - a.z) - (row.y - a.y) * (b.z - a.z)) / det;
+				if(u < 0.0f || v < 0.0f || u + v > 1.0f)
+					continue;
+
+				crossings.push_back(a.x + u * (b.x - a.x) + v * (c.x - a.x));
+			}
+
+			std::sort(crossings.begin(), crossings.end());
+
+			size_t no_crossed = 0;
+			for(int x = 0; x < dims.x; ++x)
+			{
+				float const sample_x = row.x + x * spacing;
+				while(no_crossed < crossings.size() && crossings[no_crossed] < sample_x)
+					++no_crossed;
+
+				int const idx = get_sample_index(x, y, z);
+				float const obstacle_distance = (no_crossed % 2 == 1) ? -unsigned_distance[idx] : unsigned_distance[idx];
+				distance[idx] = glm::min(distance[idx], obstacle_distance);
+			}
+		}
+	}
+}
+
+bool BoundarySDF::add_obj_obstacle(std::string const & path, glm::vec3 const translation, float const scale)
+{
+	std::ifstream file(path);
+	if(!file)
+		return false;
+
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned> indices;
+	std::string line;
+
+	while(std::getline(file, line))
+	{
+		std::istringstream tokens(line);
+		std::string type;
+		tokens >> type;
+
+		if(type == "v")
+		{
+			glm::vec3 v;
+			tokens >> v.x >> v.y >> v.z;
+			vertices.push_back(v * scale + translation);
+		}
+		else if(type == "f")
+		{
+			// "f v", "f v/vt", "f v/vt/vn", "f v//vn"; polygons triangulated as a fan
+			std::vector<unsigned> face;
+			std::string vertex;
+			while(tokens >> vertex)
+			{
+				int const idx = std::stoi(vertex.substr(0, vertex.find('/')));
+				face.push_back(static_cast<unsigned>(idx > 0 ? idx - 1 : static_cast<int>(vertices.size()) + idx));
+			}
+
+			for(size_t k = 2; k < face.size(); ++k)
+			{
+				indices.push_back(face[0]);
+				indices.push_back(face[k - 1]);
+				indices.push_back(face[k]);
+			}
+		}
+	}
+
+	add_triangle_mesh_obstacle(vertices, indices);
+	return true;
+}
+
+void BoundarySDF::finalize()
+{
+	samples.resize(distance.size());
+
+	// normal = normalized central difference gradient (one sided on lattice faces)
+	#pragma omp parallel for schedule(static)
+	for(int z = 0; z < dims.z; ++z)
+		for(int y = 0; y < dims.y; ++y)
+			for(int x = 0; x < dims.x; ++x)
+			{
+				auto const d = [&](int xx, int yy, int zz)
+				{
+					return distance[get_sample_index(glm::clamp(xx, 0, dims.x - 1), glm::clamp(yy, 0, dims.y - 1), glm::clamp(zz, 0, dims.z - 1))];
+				};
+
+				glm::vec3 gradient(d(x + 1, y, z) - d(x - 1, y, z), d(x, y + 1, z) - d(x, y - 1, z), d(x, y, z + 1) - d(x, y, z - 1));
+				float const gradient_length = glm::length(gradient);
+				gradient = gradient_length > 0.0f ? gradient / gradient_length : glm::vec3(0.0f);
+
+				samples[get_sample_index(x, y, z)] = glm::vec4(gradient, d(x, y, z));
+			}
+}
+
+void BoundarySDF::sample(glm::vec3 const p, float & distance, glm::vec3 & normal) const
+{
+	glm::vec3 const local = glm::clamp((p - origin) / spacing, glm::vec3(0.0f), glm::vec3(dims - glm::ivec3(1)) - glm::vec3(0.001f));
+	glm::ivec3 const base(local);
+	glm::vec3 const t = local - glm::vec3(base);
+
+	int const idx = get_sample_index(base.x, base.y, base.z);
+	int const sx = 1, sy = dims.x, sz = dims.x * dims.y;
+
+	glm::vec4 const c00 = glm::mix(samples[idx], samples[idx + sx], t.x);
+	glm::vec4 const c10 = glm::mix(samples[idx + sy], samples[idx + sy + sx], t.x);
+	glm::vec4 const c01 = glm::mix(samples[idx + sz], samples[idx + sz + sx], t.x);
+	glm::vec4 const c11 = glm::mix(samples[idx + sz + sy], samples[idx + sz + sy + sx], t.x);
+	glm::vec4 const value = glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+
+	distance = value.w;
+	normal = glm::vec3(value);
+	float const normal_length = glm::length(normal);
+	if(normal_length > 0.0f)
+		normal /= normal_length;
+}
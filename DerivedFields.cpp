@@ -0,0 +1,25 @@
+#include <cassert>
+
+#include "DerivedFields.hpp"
+
+
+int DerivedFields::register_interest(unsigned const fields, unsigned const interval)
+{
+	assert(interval > 0u);
+	interests.push_back({ fields, interval });
+	return static_cast<int>(interests.size()) - 1;
+}
+
+void DerivedFields::withdraw_interest(int const handle)
+{
+	interests[handle].fields = 0u;
+}
+
+unsigned DerivedFields::get_wanted(unsigned const step) const
+{
+	unsigned wanted = 0u;
+	for(auto const & interest : interests)
+		if(step % interest.interval == 0u)
+			wanted |= interest.fields;
+	return wanted;
+}
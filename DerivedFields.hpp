@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+
+/**
+ * Per-particle quantities derived from the state, not needed by the time integration itself;
+ * bits of a field set (see DerivedFields).
+ * COLOR_FIELD	color field gradient and laplacian of the force pass, magnitude of the gradient in
+ 	ParticleSystem::color_field_gradient_magnitude_channel (also the surface tension force)
+ * SURFACE_FLAGS	Particle::at_surface and the list of surface slots, classified by the force pass (see Simulation::get_surface_slots())
+ * VORTICITY	curl of velocity, 3 components in the "vorticity" channel (see Simulation::compute_vorticity())
+ * BIN_INDEX	cell index per particle in the GL buffers
+ * PARTICLE_COLOR	ParticleSystem::compute_particle_color() in the GL buffers
+ */
+enum DerivedField : unsigned
+{
+	COLOR_FIELD = 1u << 0,
+	SURFACE_FLAGS = 1u << 1,
+	VORTICITY = 1u << 2,
+	BIN_INDEX = 1u << 3,
+	PARTICLE_COLOR = 1u << 4
+};
+
+/**
+ * Who reads which derived fields and how often, so a step computes only what some consumer reads
+ * (renderer, meshing, DistanceField, exporters, physics options such as surface tension).
+ * Steps are counted as Simulation::iteration_count after the step: a consumer registered with
+ * interval n gets its fields on steps n, 2n, ...; fields are stale on the other steps.
+ */
+class DerivedFields
+{
+public:
+	// fields - DerivedField bits; interval > 0
+	// @return	handle for withdraw_interest()
+	int register_interest(unsigned const fields, unsigned const interval = 1u);
+	void withdraw_interest(int const handle);
+
+	// DerivedField bits some consumer reads on step
+	unsigned get_wanted(unsigned const step) const;
+
+private:
+	struct Interest
+	{
+		unsigned fields;// 0 - withdrawn
+		unsigned interval;
+	};
+
+	std::vector<Interest> interests;// indexed by handle
+};
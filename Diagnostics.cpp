@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <omp.h>
+
+#include "Random.hpp"
+#include "Particle.hpp"
+#include "Grid.hpp"
+#include "Diagnostics.hpp"
+
+
+DiagnosticsReport const & Diagnostics::compute(std::vector<Particle> const & particles, int const no_particles, std::array<GridCell, c::C> const & grid)
+{
+	double const start_time = omp_get_wtime();
+	int const no_blocks = (no_particles + c::diagnostics_block_size - 1) / c::diagnostics_block_size;
+	blocks.resize(std::max(no_blocks, 1));
+	blocks[0] = BlockSums();
+	auto const is_finite = [](glm::vec3 const v) { return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z); };
+
+	// 1. every block summed serially, in particle order - thread count does not matter
+	#pragma omp parallel for schedule(static) default(shared)
+	for(int b = 0; b < no_blocks; ++b)
+	{
+		BlockSums sums = BlockSums();
+		int const end = std::min(no_particles, (b + 1) * c::diagnostics_block_size);
+
+		for(int idx = b * c::diagnostics_block_size; idx < end; ++idx)
+		{
+			auto const & p = particles[idx];
+			// NaN/inf would poison every sum; std::max would even drop NaN depending on argument order
+			if(!is_finite(p.position) || !is_finite(p.velocity) || !std::isfinite(p.density))
+			{
+				++sums.no_invalid;
+				continue;
+			}
+
+			glm::dvec3 const velocity(p.velocity);
+			double const velocity_sq = glm::dot(velocity, velocity);
+
+			sums.kinetic_energy += 0.5 * p.mass * velocity_sq;
+			sums.potential_energy += -p.mass * c::gravityAcc * (static_cast<double>(p.position.y) - c::ymin);
+			sums.momentum += p.mass * velocity;
+			sums.max_velocity = std::max(sums.max_velocity, std::sqrt(velocity_sq));
+			sums.max_density_error = std::max(sums.max_density_error, std::abs(static_cast<double>(p.density) - c::restDensity) / c::restDensity);
+		}
+
+		blocks[b] = sums;
+	}
+
+	// 2. pairwise tree over blocks; its shape only depends on no_blocks
+	for(int stride = 1; stride < no_blocks; stride *= 2)
+		for(int b = 0; b + stride < no_blocks; b += 2 * stride)
+			combine(blocks[b], blocks[b + stride]);
+
+	auto const & total = blocks[0];
+	report.kinetic_energy = total.kinetic_energy;
+	report.potential_energy = total.potential_energy;
+	report.momentum = total.momentum;
+	report.max_velocity = total.max_velocity;
+	report.max_density_error = total.max_density_error;
+	report.no_invalid = total.no_invalid;
+
+	// integer counts - order of summation does not matter
+	report.cell_histogram.fill(0);
+	for(auto const & cell : grid)
+		++report.cell_histogram[std::min(cell.no_particles, c::histogram_bins - 1)];
+
+	report.compute_time = omp_get_wtime() - start_time;
+	return report;
+}
+
+void Diagnostics::combine(BlockSums & a, BlockSums const & b)
+{
+	a.kinetic_energy += b.kinetic_energy;
+	a.potential_energy += b.potential_energy;
+	a.momentum += b.momentum;
+	a.max_velocity = std::max(a.max_velocity, b.max_velocity);
+	a.max_density_error = std::max(a.max_density_error, b.max_density_error);
+	a.no_invalid += b.no_invalid;
+}
+
+uint64_t Diagnostics::state_hash(std::vector<Particle> const & particles, int const no_particles)
+{
+	auto const bits = [](float f) { uint32_t u; std::memcpy(&u, &f, sizeof(u)); return static_cast<uint64_t>(u); };
+
+	// wrapping integer sum of per-particle hashes - associative and commutative, so exact in any order
+	uint64_t sum = 0u;
+
+	#pragma omp parallel for schedule(static) reduction(+:sum)
+	for(int idx = 0; idx < no_particles; ++idx)
+	{
+		auto const & p = particles[idx];
+		uint64_t h = rng::mix(static_cast<uint64_t>(p.id) + 1u);
+		h = rng::mix(h ^ (bits(p.position.x) | bits(p.position.y) << 32));
+		h = rng::mix(h ^ (bits(p.position.z) | bits(p.velocity.x) << 32));
+		h = rng::mix(h ^ (bits(p.velocity.y) | bits(p.velocity.z) << 32));
+		h = rng::mix(h ^ bits(p.density));
+		sum += h;
+	}
+
+	return sum;
+}
+
+std::ostream & operator<<(std::ostream & os, DiagnosticsReport const & report)
+{
+	os << "E_kin " << report.kinetic_energy
+		<< ", E_pot " << report.potential_energy
+		<< ", E_mech " << report.mechanical_energy()
+		<< ", momentum (" << report.momentum.x << ", " << report.momentum.y << ", " << report.momentum.z << ")"
+		<< ", max |v| " << report.max_velocity
+		<< ", max density error " << report.max_density_error
+		<< ", invalid " << report.no_invalid
+		<< ", cells by particle count [";
+
+	for(int k = 0; k < c::histogram_bins; ++k)
+		os << (k ? " " : "") << report.cell_histogram[k];
+
+	return os << "], " << report.compute_time * 1000.0 << " ms";
+}
+
+// ----------------------------------------------------------------------------
+
+StateHashLog::StateHashLog(std::string const & log_path, std::string const & golden_path) : log(log_path), first_divergence(0u)
+{
+	std::ifstream golden_file(golden_path);
+	unsigned iteration;
+	std::string hash;
+	while(golden_file >> iteration >> hash)
+		golden[iteration] = std::stoull(hash, nullptr, 16);
+}
+
+void StateHashLog::record(unsigned iteration, uint64_t hash)
+{
+	log << iteration << " " << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec << std::endl;
+
+	auto const expected = golden.find(iteration);
+	if(expected == golden.end() || diverged())
+		return;
+
+	if(expected->second != hash)
+	{
+		first_divergence = iteration;
+		std::cerr << "state hash differs from golden run at iteration " << iteration
+			<< ": " << std::hex << hash << " != " << expected->second << std::dec << std::endl;
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+struct Particle;
+struct GridCell;
+
+/**
+ * Global quantities of one simulation step.
+ * kinetic_energy	sum of 0.5*m*|v|^2
+ * potential_energy	sum of m*|g|*(y - ymin) (gravitational, measured from the bottom of the grid)
+ * max_density_error	max |density - restDensity| / restDensity
+ * no_invalid	particles with non-finite position, velocity or density (blown up); they are left out of the other fields
+ * cell_histogram	[k] - number of grid cells holding k particles; last bin holds k >= histogram_bins - 1
+ * compute_time	wall time spent in Diagnostics::compute() [s]
+ */
+struct DiagnosticsReport
+{
+	double kinetic_energy;
+	double potential_energy;
+	glm::dvec3 momentum;
+	double max_velocity;
+	double max_density_error;
+	int no_invalid;
+	std::array<int, c::histogram_bins> cell_histogram;
+	double compute_time;
+
+	double mechanical_energy() const { return kinetic_energy + potential_energy; }
+};
+
+std::ostream & operator<<(std::ostream & os, DiagnosticsReport const & report);
+
+/**
+ * Computes DiagnosticsReport in parallel with results bitwise identical for any thread count:
+ * particles are cut into fixed-size blocks (c::diagnostics_block_size), every block is summed
+ * serially in index order (any thread may do it) and the block sums are combined by
+ * a pairwise tree whose shape depends only on the number of blocks.
+ */
+class Diagnostics
+{
+public:
+	// no_particles - live particles at the front of particles (see ParticleSystem::particle_count)
+	DiagnosticsReport const & compute(std::vector<Particle> const & particles, int const no_particles, std::array<GridCell, c::C> const & grid);
+	DiagnosticsReport const & last_report() const { return report; }
+
+	/**
+	 * Hash of particle state (id, position, velocity, density bit patterns).
+	 * Independent of particle order in memory, so runs that differ only in sorting/threads hash the same.
+	 */
+	static uint64_t state_hash(std::vector<Particle> const & particles, int const no_particles);
+
+private:
+	struct BlockSums
+	{
+		double kinetic_energy;
+		double potential_energy;
+		glm::dvec3 momentum;
+		double max_velocity;
+		double max_density_error;
+		int no_invalid;
+	};
+
+	static void combine(BlockSums & a, BlockSums const & b);
+
+	std::vector<BlockSums> blocks;
+	DiagnosticsReport report;
+};
+
+/**
+ * Writes "iteration hash" lines to a log and checks them against a golden log of a reference run
+ * (e.g. an older build or OMP_NUM_THREADS=1). To make a golden log, rename a log of a trusted run.
+ * Reports the first diverging iteration on std::cerr.
+ */
+class StateHashLog
+{
+public:
+	StateHashLog(std::string const & log_path, std::string const & golden_path);
+
+	void record(unsigned iteration, uint64_t hash);
+
+	bool has_golden() const { return !golden.empty(); }
+	bool diverged() const { return first_divergence != 0u; }
+
+private:
+	std::ofstream log;
+	std::map<unsigned, uint64_t> golden;
+	unsigned first_divergence;
+};
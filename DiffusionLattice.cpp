@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ParticleSystem.hpp"
+#include "DiffusionLattice.hpp"
+
+static_assert((!c::periodic_x || c::K % 2 == 0) && (!c::periodic_y || c::L % 2 == 0) && (!c::periodic_z || c::M % 2 == 0),
+	"splat colours cells by parity: first and last cell of a periodic axis would share nodes and a colour");
+
+namespace
+{
+	// particle mode weights pairs by m / (rho_i + rho_j), about half of the SPH Laplacian:
+	// the same diffusion coefficient diffuses equally fast on the lattice
+	auto constexpr particle_mode_factor = 0.5f;
+
+	// sub-cell (first corner) of a coordinate along one axis, kept inside the Grid cell
+	int first_sub_cell(float const local, int const cell)
+	{
+		int const subdivision = c::diffusion_lattice_subdivision;
+		return std::min(std::max(static_cast<int>(floor(local)), cell * subdivision), cell * subdivision + subdivision - 1);
+	}
+}
+
+
+DiffusionLattice::DiffusionLattice() : no_species(0)
+{
+	int const subdivision = c::diffusion_lattice_subdivision;
+	no_nodes = glm::ivec3(c::K * subdivision + (c::periodic_x ? 0 : 1), c::L * subdivision + (c::periodic_y ? 0 : 1), c::M * subdivision + (c::periodic_z ? 0 : 1));
+	spacing = glm::vec3(c::dx, c::dy, c::dz) / static_cast<float>(subdivision);
+	volumes.resize(no_nodes.x * no_nodes.y * no_nodes.z);
+	inverse_volumes.resize(volumes.size());
+}
+
+void DiffusionLattice::diffuse(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets,
+	float const * concentrations, int const no_species, float const * diffusion, float const dt, float * increments)
+{
+	this->no_species = no_species;
+
+	float lattice_diffusion[c::max_species];
+	float max_diffusion = 0.0f;
+	for(int k = 0; k < no_species; ++k)
+	{
+		lattice_diffusion[k] = particle_mode_factor * diffusion[k];
+		max_diffusion = std::max(max_diffusion, lattice_diffusion[k]);
+	}
+
+	splat(particle_system, particle_offsets, concentrations);
+
+	// 7-point stencil: no overshoot while substep * D * sum over axes of 2 / spacing^2 <= 1
+	float const stiffness = dt * max_diffusion * 2.0f * (1.0f / (spacing.x*spacing.x) + 1.0f / (spacing.y*spacing.y) + 1.0f / (spacing.z*spacing.z));
+	int const no_substeps = std::max(1, static_cast<int>(std::ceil(stiffness / c::diffusion_stability_limit)));
+	for(int substep = 0; substep < no_substeps; ++substep)
+		apply_stencil(lattice_diffusion, dt / no_substeps);
+
+	gather(particle_system, particle_offsets, increments);
+}
+
+void DiffusionLattice::get_stencil(glm::vec3 const position, glm::ivec3 const cell, int (&nodes)[8], float (&weights)[8]) const
+{
+	glm::vec3 const local = (position - glm::vec3(c::xmin, c::ymin, c::zmin)) / spacing;
+	glm::ivec3 const first(first_sub_cell(local.x, cell.x), first_sub_cell(local.y, cell.y), first_sub_cell(local.z, cell.z));
+	glm::vec3 const fraction = glm::clamp(local - glm::vec3(first), glm::vec3(0.0f), glm::vec3(1.0f));
+
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		int const x = corner & 1, y = (corner >> 1) & 1, z = (corner >> 2) & 1;
+		// along periodic axes the last sub-cell's upper nodes are the first ones
+		int const node_x = (first.x + x) % no_nodes.x, node_y = (first.y + y) % no_nodes.y, node_z = (first.z + z) % no_nodes.z;
+		nodes[corner] = node_x + (node_y + node_z * no_nodes.y) * no_nodes.x;
+		weights[corner] = (x ? fraction.x : 1.0f - fraction.x) * (y ? fraction.y : 1.0f - fraction.y) * (z ? fraction.z : 1.0f - fraction.z);
+	}
+}
+
+void DiffusionLattice::splat(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets, float const * concentrations)
+{
+	auto const & particles = particle_system.particles;
+	int const no_lattice_nodes = static_cast<int>(volumes.size());
+	std::fill(volumes.begin(), volumes.end(), 0.0f);
+	initial.assign(no_lattice_nodes * no_species, 0.0f);
+
+	// cells of one colour (parity along every axis) share no nodes: no atomics, and every node
+	// sums its contributions in the same order for any number of threads
+	for(int colour = 0; colour < 8; ++colour)
+	{
+		int const offset_x = colour & 1, offset_y = (colour >> 1) & 1, offset_z = (colour >> 2) & 1;
+		int const half_x = (c::K - offset_x + 1) / 2, half_y = (c::L - offset_y + 1) / 2, half_z = (c::M - offset_z + 1) / 2;
+
+		#pragma omp parallel for schedule(static)
+		for(int n = 0; n < half_x * half_y * half_z; ++n)
+		{
+			glm::ivec3 const cell(offset_x + 2 * (n % half_x), offset_y + 2 * (n / half_x % half_y), offset_z + 2 * (n / (half_x * half_y)));
+			int const idx = cell.x + cell.y * c::K + cell.z * c::K * c::L;// see get_cell_index()
+
+			for(int slot = particle_offsets[idx]; slot < particle_offsets[idx + 1]; ++slot)
+			{
+				int nodes[8];
+				float weights[8];
+				get_stencil(particles[slot].position, cell, nodes, weights);
+
+				float const volume = particles[slot].mass / particles[slot].density;
+				for(int corner = 0; corner < 8; ++corner)
+				{
+					float const weight = weights[corner] * volume;
+					volumes[nodes[corner]] += weight;
+					for(int k = 0; k < no_species; ++k)
+						initial[k * no_lattice_nodes + nodes[corner]] += weight * concentrations[slot * no_species + k];
+				}
+			}
+		}
+	}
+
+	// weighted sums -> averages
+	#pragma omp parallel for schedule(static)
+	for(int node = 0; node < no_lattice_nodes; ++node)
+	{
+		inverse_volumes[node] = volumes[node] > 0.0f ? 1.0f / volumes[node] : 0.0f;
+		for(int k = 0; k < no_species; ++k)
+			initial[k * no_lattice_nodes + node] *= inverse_volumes[node];
+	}
+
+	values = initial;
+	next_values.resize(values.size());
+}
+
+void DiffusionLattice::apply_stencil(float const * diffusion, float const dt)
+{
+	int const nx = no_nodes.x, ny = no_nodes.y, nz = no_nodes.z;
+	int const no_lattice_nodes = nx * ny * nz;
+
+	for(int k = 0; k < no_species; ++k)
+	{
+		float const * const current = values.data() + k * no_lattice_nodes;
+		float * const next = next_values.data() + k * no_lattice_nodes;
+		float const rx = dt * diffusion[k] / (spacing.x*spacing.x);
+		float const ry = dt * diffusion[k] / (spacing.y*spacing.y);
+		float const rz = dt * diffusion[k] / (spacing.z*spacing.z);
+
+		#pragma omp parallel for schedule(static)
+		for(int row = 0; row < ny * nz; ++row)
+		{
+			int const y = row % ny, z = row / ny;
+			// across a non-periodic face the neighbour is the node itself: no flux
+			int const y_minus = y > 0 ? y - 1 : (c::periodic_y ? ny - 1 : y);
+			int const y_plus = y < ny - 1 ? y + 1 : (c::periodic_y ? 0 : y);
+			int const z_minus = z > 0 ? z - 1 : (c::periodic_z ? nz - 1 : z);
+			int const z_plus = z < nz - 1 ? z + 1 : (c::periodic_z ? 0 : z);
+
+			int const center_row = row * nx;
+			int const rows[4] = { (y_minus + z * ny) * nx, (y_plus + z * ny) * nx, (y + z_minus * ny) * nx, (y + z_plus * ny) * nx };
+			float const * const c_ym = current + rows[0], * const c_yp = current + rows[1], * const c_zm = current + rows[2], * const c_zp = current + rows[3];
+			float const * const v_ym = volumes.data() + rows[0], * const v_yp = volumes.data() + rows[1], * const v_zm = volumes.data() + rows[2], * const v_zp = volumes.data() + rows[3];
+			float const * const c_row = current + center_row;
+			float const * const v_row = volumes.data() + center_row;
+			float const * const inverse_v_row = inverse_volumes.data() + center_row;
+			float * const next_row = next + center_row;
+
+			// flux between two nodes is limited by the smaller fluid volume: dry nodes (volume 0) exchange nothing
+			// and a nearly dry node is not drained faster than a full one, so the sub-step bound holds
+			auto update = [&](int const x, int const x_minus, int const x_plus)
+			{
+				float const value = c_row[x];
+				float const volume = v_row[x];
+				float const change = rx * (std::min(volume, v_row[x_minus]) * (c_row[x_minus] - value) + std::min(volume, v_row[x_plus]) * (c_row[x_plus] - value))
+					+ ry * (std::min(volume, v_ym[x]) * (c_ym[x] - value) + std::min(volume, v_yp[x]) * (c_yp[x] - value))
+					+ rz * (std::min(volume, v_zm[x]) * (c_zm[x] - value) + std::min(volume, v_zp[x]) * (c_zp[x] - value));
+				next_row[x] = value + inverse_v_row[x] * change;
+			};
+
+			update(0, c::periodic_x ? nx - 1 : 0, 1);
+			// interior without branches: contiguous in x, vectorises
+			for(int x = 1; x < nx - 1; ++x)
+				update(x, x - 1, x + 1);
+			update(nx - 1, nx - 2, c::periodic_x ? 0 : nx - 1);
+		}
+	}
+
+	values.swap(next_values);
+}
+
+void DiffusionLattice::gather(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets, float * increments) const
+{
+	auto const & particles = particle_system.particles;
+	int const no_lattice_nodes = static_cast<int>(volumes.size());
+
+	// read only: all cells at once
+	#pragma omp parallel for schedule(static)
+	for(int idx = 0; idx < c::C; ++idx)
+	{
+		glm::ivec3 const cell(idx % c::K, idx / c::K % c::L, idx / (c::K * c::L));
+
+		for(int slot = particle_offsets[idx]; slot < particle_offsets[idx + 1]; ++slot)
+		{
+			int nodes[8];
+			float weights[8];
+			get_stencil(particles[slot].position, cell, nodes, weights);
+
+			for(int k = 0; k < no_species; ++k)
+			{
+				float increment = 0.0f;
+				for(int corner = 0; corner < 8; ++corner)
+				{
+					int const value = k * no_lattice_nodes + nodes[corner];
+					increment += weights[corner] * (values[value] - initial[value]);
+				}
+				increments[slot * no_species + k] = increment;
+			}
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+class ParticleSystem;
+
+/**
+ * Regular lattice over the whole Grid, used to diffuse particle scalars (species) on a
+ * 7-point stencil instead of over pairs of neighbours: cost per step is O(particles + nodes).
+ * Nodes sit at corners of sub-cells, c::diffusion_lattice_subdivision per Grid cell and axis.
+ * One step:
+ *	splat	particle values to the 8 surrounding nodes, trilinear weights times particle volume m / rho;
+ 	nodes nobody splatted to are dry (no flux through them, like the fluid surface)
+ *	stencil	explicit sub-steps in flux form, fluid volume of nodes as capacity (as few sub-steps as the stability bound allows)
+ *	gather	every particle takes the trilinear interpolation of its nodes' change (not of their values,
+ 	so the field is not smoothed by the round trip itself)
+ * Splat and gather use the same weights, so sum of volume * concentration over particles is conserved.
+ */
+class DiffusionLattice
+{
+public:
+	DiffusionLattice();
+
+	/**
+	 * @param particle_offsets	exclusive prefix sum of particles per Grid cell (see Grid); particles sorted by cell
+	 * @param concentrations, increments	[slot * no_species + k]
+	 * @param diffusion	coefficient per species, same meaning as in the particle mode (see ReactionDiffusion)
+	 */
+	void diffuse(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets,
+		float const * concentrations, int const no_species, float const * diffusion, float const dt, float * increments);
+
+private:
+	void splat(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets, float const * concentrations);
+	// one explicit step of all species, current values -> next values
+	void apply_stencil(float const * diffusion, float const dt);
+	void gather(ParticleSystem const & particle_system, std::array<int, c::C + 1> const & particle_offsets, float * increments) const;
+
+	/**
+	 * 8 nodes around position and their trilinear weights.
+	 * @param cell	Grid cell of the particle: nodes never leave its corners, even when position is
+	 	within round-off of the cell border (splat relies on it to update nodes without races)
+	 */
+	void get_stencil(glm::vec3 const position, glm::ivec3 const cell, int (&nodes)[8], float (&weights)[8]) const;
+
+	int no_species;
+	glm::ivec3 no_nodes;// per axis; one more than sub-cells along non-periodic axes
+	glm::vec3 spacing;
+
+	std::vector<float> volumes;// [node], 0 - dry
+	std::vector<float> inverse_volumes;// [node], 0 for dry nodes (multiplied, so the stencil has no branches)
+	std::vector<float> initial;// [k * no_nodes + node], after splat
+	std::vector<float> values;// [k * no_nodes + node], diffused
+	std::vector<float> next_values;
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+/**
+ * What differs between 3D and 2D builds (c::dimensions); everything else is one code path.
+ * 2D keeps glm::vec3 with z pinned to 0 (see pin()) on a grid one cell thick along z,
+ * so particles, GL buffers and the renderer are untouched.
+ * reach_z	1 - neighbour cells are searched along z as along x and y (3D), 0 - only in the particle's layer (2D);
+ 	see Grid::get_reach()
+ * h_scale(mass_ratio)	mass_ratio^(1/D): support radius of a particle of mass_ratio * c::particleMass
+ 	(in units of c::H) at the same particle spacing to h ratio
+ * kernel normalisations (support h, see kernel::):
+ 	poly6	W = poly6 * (h^2 - r^2)^3
+ 	poly6_gradient	gradW = poly6_gradient * (h^2 - r^2)^2 * rVec
+ 	poly6_laplacian_shape	lapW = poly6_gradient * (h^2 - r^2) * shape
+ 	spiky_gradient	gradW = spiky_gradient * (h - r)^2 / r * rVec
+ 	viscosity_laplacian	lapW = viscosity_laplacian * (h - r)
+ 	spline_gradient	gradW of the cubic spline = spline_gradient * shape(q) * rVec / (r h)
+ */
+namespace dimension
+{
+	template<int D>
+	struct Traits;
+
+	// Muller et al. 2003 "Particle-Based Fluid Simulation for Interactive Applications"
+	template<>
+	struct Traits<3>
+	{
+		static int constexpr reach_z = 1;
+
+		static float h_scale(float const mass_ratio) { return std::cbrt(mass_ratio); }
+
+		static float poly6(float const h) { return 315.0f / (64.0f*c::PIf*pow(h, 9)); }
+		static float poly6_gradient(float const h) { return -945.0f / (32.0f*c::PIf*pow(h, 9)); }
+		template<typename Real>
+		static double poly6_laplacian_shape(Real const h, Real const r) { return 3.0f*pow(h, 2) - 7.0f*pow(r, 2); }
+		static float spiky_gradient(float const h) { return -45.0f / (c::PIf*pow(h, 6)); }
+		static float viscosity_laplacian(float const h) { return 45.0f / (c::PIf*pow(h, 6)); }
+		static double spline_gradient(float const h) { return 6.0f * (8.0f/c::PIf) / pow(h, 3); }
+	};
+
+	// the same kernels normalised over a disc
+	template<>
+	struct Traits<2>
+	{
+		static int constexpr reach_z = 0;
+
+		static float h_scale(float const mass_ratio) { return std::sqrt(mass_ratio); }
+
+		static float poly6(float const h) { return 4.0f / (c::PIf*pow(h, 8)); }
+		static float poly6_gradient(float const h) { return -24.0f / (c::PIf*pow(h, 8)); }
+		template<typename Real>
+		static double poly6_laplacian_shape(Real const h, Real const r) { return 2.0f*pow(h, 2) - 6.0f*pow(r, 2); }
+		static float spiky_gradient(float const h) { return -30.0f / (c::PIf*pow(h, 5)); }
+		static float viscosity_laplacian(float const h) { return 40.0f / (c::PIf*pow(h, 5)); }
+		static double spline_gradient(float const h) { return 6.0f * (40.0f/(7.0f*c::PIf)) / pow(h, 2); }
+	};
+
+	using Current = Traits<c::dimensions>;
+
+	// drops z in 2D; identity in 3D
+	inline glm::vec3 pin(glm::vec3 v)
+	{
+		if(c::dimensions == 2)
+			v.z = 0.0f;
+		return v;
+	}
+}
@@ -101,15 +101,16 @@ bool DistanceField::out_of_voxel_grid_scope(glm::vec3 const idx) const
 	return idx.x >= c::voxelGridDimension || idx.x < 0 || idx.y >= c::voxelGridDimension || idx.y < 0 || idx.z >= c::voxelGridDimension || idx.z < 0;
 }
 
-void DistanceField::generate_field_from_surface_particles(std::vector<Particle> const & surface_particles)
+void DistanceField::generate_field_from_surface_particles(std::vector<Particle> const & particles, std::vector<int> const & surface_slots)
 {
 	// will contain a distance from vertex to the closest surface particle
 	std::array<GLfloat, c::voxelGrid3dSize> voxel_grid;
 	voxel_grid.fill(c::rmax);
 
 	// for every surface particle
-	for(auto const & p : surface_particles)
+	for(int const slot : surface_slots)
 	{
+		auto const & p = particles[slot];
 		auto const p_pos = p.position;
 		// bound it with 'bounding cube'
 
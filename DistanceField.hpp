@@ -18,7 +18,8 @@ public:
 	void paint(Painter& p) const override final;
 	void setup_buffers() override final;
 
-	void generate_field_from_surface_particles(std::vector<Particle> const & surface_particles);
+	// surface_slots - indices into particles (see Simulation::get_surface_slots())
+	void generate_field_from_surface_particles(std::vector<Particle> const & particles, std::vector<int> const & surface_slots);
 
 	GLuint const get_density_texture() const { return volume_texture; }
 	std::pair<GLuint, GLuint> const get_front_back_color_cube_textures() const
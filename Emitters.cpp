@@ -1,27 +1,28 @@
-#include <cstdlib>
-#include <ctime>
+#include <algorithm>
 
+#include "Random.hpp"
 #include "ParticleSystem.hpp"
 #include "Emitters.hpp"
 
-Emitters::Emitters() : particle_system_ref(nullptr)
+Emitters::Emitters() : particle_system_ref(nullptr), no_emitters_added(0u)
 {
-	srand(static_cast<unsigned int>(time(nullptr)));
 }
 
-void Emitters::emit()
+void Emitters::emit(float const dt)
 {
 	for (auto & emitter : _emitters)
 	{
-		emitter.ttl -= c::dt;
-		emitter.last_emission_time += c::dt;
+		emitter.ttl -= dt;
+		emitter.last_emission_time += dt;
 
 		if (emitter.last_emission_time >= emitter.delay)
 		{
-			auto const mod = [&] { return emitter.emit_radius * (1.0f - 2.0f * static_cast<float>(static_cast<float>(rand()) / RAND_MAX)); };
+			// counter: which emitter, which emission, which axis - independent of emission order between emitters
+			auto const mod = [&](uint64_t axis) { return emitter.emit_radius * rng::uniform(rng::EMITTER_OFFSET, (static_cast<uint64_t>(emitter.serial) << 40) | (emitter.no_emitted * 3u + axis), -1.0f, 1.0f); };
 
-			auto new_position = emitter.position + glm::vec3(mod(), mod(), mod());
+			auto new_position = emitter.position + glm::vec3(mod(0u), mod(1u), mod(2u));
 			particle_system_ref->add_particle(new_position, emitter.emit_velocity);
+			++emitter.no_emitted;
 
 			emitter.last_emission_time = 0.0f;
 		}
@@ -32,6 +33,29 @@ void Emitters::emit()
 		_emitters.end());
 }
 
+void Emitters::absorb()
+{
+	if(_outflows.empty())
+		return;
+
+	auto & particles = particle_system_ref->particles;
+	int const no_particles = particle_system_ref->particle_count;
+
+	#pragma omp parallel for schedule(static)
+	for(int idx = 0; idx < no_particles; ++idx)
+	{
+		glm::vec3 const position = particles[idx].position;
+		for(auto const & outflow : _outflows)
+		{
+			if(glm::all(glm::greaterThanEqual(position, outflow.min_corner)) && glm::all(glm::lessThanEqual(position, outflow.max_corner)))
+			{
+				particle_system_ref->kill(idx);
+				break;
+			}
+		}
+	}
+}
+
 bool Emitters::is_any_emitter_alive() const
 {
 	if(_emitters.empty())
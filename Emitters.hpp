@@ -1,7 +1,10 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "constants.hpp"
+
 class ParticleSystem;
 
 /**
@@ -10,10 +13,11 @@ class ParticleSystem;
  * ttl	time to live; decreases; if equals 0 then Emitter is removed
  * delay	time interval for eitting another particle
  * emit_radius	radius in which particles appear; r = h
+ * serial, no_emitted	counters for random offsets (see rng); serial is set by Emitters::add_emitter()
  */
 struct Emitter
 {
-	Emitter(glm::vec3 pos, glm::vec3 vel) : position(pos), emit_velocity(vel), ttl(6.0f), last_emission_time(0.0f), delay(c::dt), emit_radius(0.5f * c::H) { }
+	Emitter(glm::vec3 pos, glm::vec3 vel) : position(pos), emit_velocity(vel), ttl(6.0f), last_emission_time(0.0f), delay(c::dt), emit_radius(0.5f * c::H), serial(0u), no_emitted(0u) { }
 	Emitter(glm::vec3 pos) : Emitter(pos, glm::vec3(0.0f)) { }
 	glm::vec3 position;
 	glm::vec3 emit_velocity;
@@ -21,6 +25,18 @@ struct Emitter
 	float last_emission_time;
 	float delay;
 	float emit_radius;
+	unsigned serial;
+	uint64_t no_emitted;
+};
+
+/**
+ * Outflow zone: particles inside [min_corner, max_corner] are killed
+ * (their slots are reused by emitters, see ParticleSystem::add_particle)
+ */
+struct Outflow
+{
+	glm::vec3 min_corner;
+	glm::vec3 max_corner;
 };
 
 class Emitters
@@ -29,17 +45,25 @@ class Emitters
 public:
 	Emitters();
 
-	void emit();
+	// dt - length of the simulation step; emitters age and emit in simulation time
+	void emit(float const dt);
+	// kills particles which entered any outflow zone
+	void absorb();
 	bool is_any_emitter_alive() const;
 	void add_emitter(Emitter const & em)
 	{
 		_emitters.push_back(em);
+		_emitters.back().serial = no_emitters_added++;
 	}
 
+	void add_outflow(Outflow const & outflow) { _outflows.push_back(outflow); }
+
 	void set_particle_system(ParticleSystem & ps) { particle_system_ref = &ps; };
 
 private:
 	std::vector<Emitter> _emitters;
+	std::vector<Outflow> _outflows;
 
 	ParticleSystem * particle_system_ref;
+	unsigned no_emitters_added;
 };
\ No newline at end of file
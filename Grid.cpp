@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
 #include "Painter.hpp"
+#include "BoundarySDF.hpp"
+#include "Dimension.hpp"
 #include "Grid.hpp"
 
 
@@ -24,8 +31,11 @@ GLuint const Grid::cube_indices[16] =
 	0, 4, 1, 5, 2, 6, 3, 7
 };
 
-Grid::Grid()
+Grid::Grid() : max_h(c::H)
 {
+	wall_coverage.fill(0);
+	near_wall_slot.fill(-1);
+	neighbourhood_max_h.fill(c::H);
 	setup_buffers();
 }
 
@@ -84,6 +94,95 @@ void Grid::clear_grid()
 {
 	std::for_each(std::begin(grid), std::end(grid), [&](GridCell& c)
 	{
-		c = { nullptr, 0 };
+		c = { nullptr, 0, 0.0f };
 	});
-}
\ No newline at end of file
+}
+void Grid::spread_max_h()
+{
+	// a particle of max_h reaches this many cells, whatever the other one of the pair
+	glm::ivec3 const reach = get_reach(max_h);
+
+	for(int z = 0; z < c::M; ++z)
+		for(int y = 0; y < c::L; ++y)
+			for(int x = 0; x < c::K; ++x)
+			{
+				float neighbourhood_h = 0.0f;
+				for(int oz = -reach.z; oz <= reach.z; ++oz)
+					for(int oy = -reach.y; oy <= reach.y; ++oy)
+						for(int ox = -reach.x; ox <= reach.x; ++ox)
+						{
+							int const nx = c::periodic_x ? (x + ox + c::K) % c::K : x + ox;
+							int const ny = c::periodic_y ? (y + oy + c::L) % c::L : y + oy;
+							int const nz = c::periodic_z ? (z + oz + c::M) % c::M : z + oz;
+							if(nx < 0 || nx >= c::K || ny < 0 || ny >= c::L || nz < 0 || nz >= c::M)
+								continue;
+							neighbourhood_h = std::max(neighbourhood_h, grid[nx + ny*c::K + nz*c::K*c::L].max_h);
+						}
+				neighbourhood_max_h[x + y*c::K + z*c::K*c::L] = neighbourhood_h;
+			}
+}
+
+void Grid::find_near_wall_cells(BoundarySDF const & boundary)
+{
+	glm::vec3 const cell_size(c::dx, c::dy, c::dz);
+	// the distance field is 1-Lipschitz: no point of a cell is nearer to a wall than
+	// its center distance minus half of the diagonal (plus a lattice spacing for interpolation error)
+	float const reach = c::H + 0.5f*glm::length(cell_size) + c::sdf_spacing;
+
+	for(int z = 0; z < c::M; ++z)
+		for(int y = 0; y < c::L; ++y)
+			for(int x = 0; x < c::K; ++x)
+			{
+				glm::vec3 const center = glm::vec3(c::xmin, c::ymin, c::zmin) + (glm::vec3(x, y, z) + glm::vec3(0.5f))*cell_size;
+				float distance;
+				glm::vec3 normal;
+				boundary.sample(center, distance, normal);
+
+				if(distance < reach)
+					cover_cell(x + y*c::K + z*c::K*c::L, 1);
+			}
+}
+
+void Grid::cover_cells(glm::ivec3 const first, glm::ivec3 const last, int const delta)
+{
+	for(int z = first.z; z <= last.z; ++z)
+		for(int y = first.y; y <= last.y; ++y)
+			for(int x = first.x; x <= last.x; ++x)
+				cover_cell(x + y*c::K + z*c::K*c::L, delta);
+}
+
+glm::ivec3 Grid::get_reach(float const radius)
+{
+	glm::ivec3 const reach(static_cast<int>(std::ceil(radius / c::dx)), static_cast<int>(std::ceil(radius / c::dy)),
+		dimension::Current::reach_z * static_cast<int>(std::ceil(radius / c::dz)));
+	assert((!c::periodic_x || 2 * reach.x < c::K) && (!c::periodic_y || 2 * reach.y < c::L) && (!c::periodic_z || 2 * reach.z < c::M));
+	return reach;
+}
+
+float Grid::get_gap(glm::ivec3 const offset)
+{
+	// whole cells between the two
+	int const x = std::max(std::abs(offset.x) - 1, 0), y = std::max(std::abs(offset.y) - 1, 0), z = std::max(std::abs(offset.z) - 1, 0);
+	return std::max(std::max(x*c::dx, y*c::dy), z*c::dz);
+}
+
+void Grid::cover_cell(int const idx, int const delta)
+{
+	int const previous_coverage = wall_coverage[idx];
+	wall_coverage[idx] += delta;
+
+	if(previous_coverage == 0 && wall_coverage[idx] > 0)
+	{
+		near_wall_slot[idx] = static_cast<int>(near_wall_cells.size());
+		near_wall_cells.push_back(idx);
+	}
+	else if(previous_coverage > 0 && wall_coverage[idx] == 0)
+	{
+		// swap with the last one - order of near_wall_cells does not matter
+		int const slot = near_wall_slot[idx];
+		near_wall_cells[slot] = near_wall_cells.back();
+		near_wall_slot[near_wall_cells[slot]] = slot;
+		near_wall_cells.pop_back();
+		near_wall_slot[idx] = -1;
+	}
+}
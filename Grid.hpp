@@ -1,11 +1,13 @@
 #pragma once
 #include <array>
+#include <vector>
 
 #include "constants.hpp"
 #include "Paintable.hpp"
 
 
 struct Particle;
+class BoundarySDF;
 
 struct GridCell
 {
@@ -13,6 +15,8 @@ struct GridCell
 	Particle* first_particle;
 	// Particles count in the list
 	int no_particles;
+	// largest Particle::h in the list
+	float max_h;
 };
 
 /**
@@ -35,11 +39,51 @@ public:
 
 	void clear_grid();
 
+	/**
+	 * After binning: for every cell the largest GridCell::max_h of the cells whose particles can
+	 * reach into it (see neighbourhood_max_h), so particles away from large ones keep a small search.
+	 */
+	void spread_max_h();
+
+	/**
+	 * Collects cells in which a particle can be closer than c::H to a boundary (or inside a solid).
+	 * Boundaries are static, so it is done once, after BoundarySDF::finalize().
+	 */
+	void find_near_wall_cells(BoundarySDF const & boundary);
+
+	/**
+	 * Adds (delta = 1) or removes (delta = -1) one wall's claim on the inclusive cell range [first, last];
+	 * a cell is in near_wall_cells while at least one wall claims it. Used for moving boundaries,
+	 * so near_wall_cells is patched instead of rebuilt every step.
+	 */
+	void cover_cells(glm::ivec3 const first, glm::ivec3 const last, int const delta);
+
+	/**
+	 * Cells to search on each side of a particle's cell, per axis, so that everything closer than radius
+	 * is found: ceil(radius / cell size), 0 along z in 2D (see dimension::Traits::reach_z).
+	 * Along a periodic axis the search must not wrap onto itself: 2 * reach < number of cells.
+	 */
+	static glm::ivec3 get_reach(float const radius);
+	/**
+	 * Lower bound of the distance between a particle and any particle of the cell offset cells away
+	 * from its own; a cell with max_h so small that kernel::symmetric(h, max_h) <= gap holds no neighbour
+	 * (except ones exactly at the support radius, which contribute nothing).
+	 */
+	static float get_gap(glm::ivec3 const offset);
+
 	GLsizei const bin_count = c::C;
 
 private:
+	void cover_cell(int const idx, int const delta);
+
 	// Hot stuff
 	std::array<GridCell, c::C> grid;// grid of all cells (containing all Particles)
+	std::array<int, c::C + 1> particle_offsets;// exclusive prefix sum of GridCell::no_particles; [c::C] == binned particles count
+	float max_h;// largest Particle::h of the binned particles
+	std::array<float, c::C> neighbourhood_max_h;// see spread_max_h(); a particle of the cell has no pair with a larger support radius than kernel::symmetric(h, this)
+	std::vector<int> near_wall_cells;// indices of cells visited by collision handling, unordered
+	std::array<int, c::C> wall_coverage;// number of walls claiming a cell
+	std::array<int, c::C> near_wall_slot;// position of a cell in near_wall_cells, -1 if not there
 
 	// Geometry, instance offset array
 	GLfloat const static cube_vertices[8*3];
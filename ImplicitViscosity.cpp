@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+
+#include "constants.hpp"
+#include "NeighbourList.hpp"
+#include "ParticleSystem.hpp"
+#include "ImplicitViscosity.hpp"
+
+
+ImplicitViscosity::ImplicitViscosity() : last_iterations(0), last_residual(0.0f)
+{
+}
+
+void ImplicitViscosity::solve(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights,
+	std::vector<float> const & boundary_weights, float const dt)
+{
+	auto & particles = particle_system.particles;
+	auto const & offsets = neighbours.get_offsets();
+	int const no_particles = neighbours.get_no_particles();
+	float const coefficient = dt * c::viscosity;
+
+	diagonal.resize(no_particles);
+	inverse_preconditioner.resize(no_particles);
+	rhs.resize(no_particles);
+	solution.resize(no_particles);
+	residual.resize(no_particles);
+	preconditioned.resize(no_particles);
+	direction.resize(no_particles);
+	product.resize(no_particles);
+
+	// b = m rho v*, x0 = v
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		auto const & p = particles[slot];
+		float row_sum = 0.0f;
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+			row_sum += weights[n];
+
+		diagonal[slot] = p.mass * p.density + (boundary_weights.empty() ? 0.0f : coefficient * boundary_weights[slot]);
+		inverse_preconditioner[slot] = 1.0f / (diagonal[slot] + coefficient * row_sum);
+		rhs[slot] = p.mass * p.density * (p.velocity + p.acc * dt);
+		solution[slot] = p.velocity;
+	}
+
+	// r = b - A x0, z = M^-1 r, d = z
+	multiply(solution, product, neighbours, weights, coefficient);
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		residual[slot] = rhs[slot] - product[slot];
+		preconditioned[slot] = inverse_preconditioner[slot] * residual[slot];
+		direction[slot] = preconditioned[slot];
+	}
+
+	// b M^-1 b - reference for the relative residual
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+		product[slot] = inverse_preconditioner[slot] * rhs[slot];
+	glm::dvec3 const reference = glm::max(dot(rhs, product, no_particles), glm::dvec3(1e-30));
+
+	glm::dvec3 rz = dot(residual, preconditioned, no_particles);
+	double const tolerance_sq = static_cast<double>(c::viscosity_cg_tolerance) * c::viscosity_cg_tolerance;
+	int iteration = 0;
+	for(; iteration < c::viscosity_cg_max_iterations; ++iteration)
+	{
+		if(rz.x <= tolerance_sq * reference.x && rz.y <= tolerance_sq * reference.y && rz.z <= tolerance_sq * reference.z)
+			break;
+
+		multiply(direction, product, neighbours, weights, coefficient);
+		glm::dvec3 const d_ad = dot(direction, product, no_particles);
+		// a converged component has rz == 0 (or d A d == 0): it stops moving
+		glm::vec3 const alpha(
+			d_ad.x > 0.0 ? rz.x / d_ad.x : 0.0,
+			d_ad.y > 0.0 ? rz.y / d_ad.y : 0.0,
+			d_ad.z > 0.0 ? rz.z / d_ad.z : 0.0);
+
+		#pragma omp parallel for schedule(static)
+		for(int slot = 0; slot < no_particles; ++slot)
+		{
+			solution[slot] += alpha * direction[slot];
+			residual[slot] -= alpha * product[slot];
+			preconditioned[slot] = inverse_preconditioner[slot] * residual[slot];
+		}
+
+		glm::dvec3 const new_rz = dot(residual, preconditioned, no_particles);
+		glm::vec3 const beta(
+			rz.x > 0.0 ? new_rz.x / rz.x : 0.0,
+			rz.y > 0.0 ? new_rz.y / rz.y : 0.0,
+			rz.z > 0.0 ? new_rz.z / rz.z : 0.0);
+		rz = new_rz;
+
+		#pragma omp parallel for schedule(static)
+		for(int slot = 0; slot < no_particles; ++slot)
+			direction[slot] = preconditioned[slot] + beta * direction[slot];
+	}
+
+	last_iterations = iteration;
+	last_residual = static_cast<float>(std::sqrt(std::max(std::max(rz.x / reference.x, rz.y / reference.y), rz.z / reference.z)));
+
+	// integrators take accelerations: the one which turns v* into the solution
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		auto & p = particles[slot];
+		p.acc += (solution[slot] - (p.velocity + p.acc * dt)) / dt;
+	}
+}
+
+void ImplicitViscosity::multiply(std::vector<glm::vec3> const & x, std::vector<glm::vec3> & result, NeighbourList const & neighbours,
+	std::vector<float> const & weights, float const coefficient) const
+{
+	auto const & offsets = neighbours.get_offsets();
+	auto const & pairs = neighbours.get_neighbours();
+	int const no_particles = neighbours.get_no_particles();
+
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		glm::vec3 laplacian(0.0f);
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+			laplacian += weights[n] * (x[slot] - x[pairs[n].slot]);
+
+		result[slot] = diagonal[slot] * x[slot] + coefficient * laplacian;
+	}
+}
+
+glm::dvec3 ImplicitViscosity::dot(std::vector<glm::vec3> const & a, std::vector<glm::vec3> const & b, int const no_particles)
+{
+	int const block_size = c::diagnostics_block_size;
+	int const no_blocks = (no_particles + block_size - 1) / block_size;
+	block_sums.resize(no_blocks);
+
+	#pragma omp parallel for schedule(static)
+	for(int block = 0; block < no_blocks; ++block)
+	{
+		glm::dvec3 sum(0.0);
+		int const end = std::min(no_particles, (block + 1) * block_size);
+		for(int slot = block * block_size; slot < end; ++slot)
+			sum += glm::dvec3(a[slot] * b[slot]);
+		block_sums[block] = sum;
+	}
+
+	glm::dvec3 total(0.0);
+	for(int block = 0; block < no_blocks; ++block)
+		total += block_sums[block];
+	return total;
+}
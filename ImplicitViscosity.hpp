@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class ParticleSystem;
+class NeighbourList;
+
+/**
+ * Backward Euler viscosity, for fluids whose explicit viscous time step limit
+ * (dt < ~ rho h^2 / viscosity) is far below the pressure one.
+ * Velocities after the step solve, per particle i,
+ *	m_i rho_i v_i + dt viscosity (sum_j weights[ij] (v_i - v_j) + boundary_weights[i] v_i) = m_i rho_i v*_i
+ * where v* = v + acc dt (acc without viscosity); rows are the momentum balance times m_i, so with
+ * weights[ij] = m_i m_j f(rho_i, rho_j, r_ij) the matrix is symmetric for any masses. It is positive definite
+ * (weights symmetric, >= 0), so it is solved by conjugate gradients with a Jacobi preconditioner,
+ * matrix-free over the NeighbourList of the step; the three velocity components are independent CGs in lockstep.
+ * Starts from the current velocities (the solution of the previous step), so a slowly changing flow
+ * converges in a few iterations. Dot products are summed in fixed blocks: results do not depend on thread count.
+ */
+class ImplicitViscosity
+{
+public:
+	ImplicitViscosity();
+
+	/**
+	 * Adds the viscous acceleration (v - v*) / dt to Particle::acc of live particles.
+	 * @param weights	one per pair of neighbours, indexed like neighbours.get_neighbours(); row i scaled by m_i
+	 * @param boundary_weights	per slot, scaled by m_i; friction of static walls (v = 0), may be empty
+	 */
+	void solve(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights,
+		std::vector<float> const & boundary_weights, float const dt);
+
+	int get_last_iterations() const { return last_iterations; }
+	// max over components of |r| / |b| (preconditioned norms) after the last solve
+	float get_last_residual() const { return last_residual; }
+
+private:
+	// A x over the rows [0, no_particles)
+	void multiply(std::vector<glm::vec3> const & x, std::vector<glm::vec3> & result, NeighbourList const & neighbours,
+		std::vector<float> const & weights, float const coefficient) const;
+	// per component sums of a * b, in fixed blocks
+	glm::dvec3 dot(std::vector<glm::vec3> const & a, std::vector<glm::vec3> const & b, int const no_particles);
+
+	std::vector<float> diagonal;// m_i rho_i + dt viscosity boundary_weights[i]
+	std::vector<float> inverse_preconditioner;// 1 / diagonal of the whole matrix
+	std::vector<glm::vec3> rhs, solution, residual, preconditioned, direction, product;
+	std::vector<glm::dvec3> block_sums;
+
+	int last_iterations;
+	float last_residual;
+};
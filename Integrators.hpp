@@ -0,0 +1,110 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "Particle.hpp"
+
+/**
+ * Time integrators, as policies of Simulation::advance_with<Integrator>() (chosen by c::integrator),
+ * so the loop over particles is instantiated and inlined for each one.
+ * Every policy has:
+ * name()	for reports
+ * no_history_components	floats per particle kept between steps in a SORTED channel (0 - none);
+ 	new particles start with zeros there
+ * step(particle, history, dt)	advances position and velocity from particle.acc (forces at the start of the step);
+ 	history is nullptr when no_history_components == 0. Positions are wrapped by the caller.
+ * staggered	velocities after step() are not at the time of positions
+ * synchronise(particle, dt)	turns a stepped (not yet wrapped) particle into the state of one time,
+ 	for diagnostics (energies); does nothing unless staggered
+ * All use one force evaluation per step.
+ */
+namespace integrator
+{
+	// v += a dt, x += v dt; first order, symplectic
+	struct SymplecticEuler
+	{
+		static char const * name() { return "symplectic Euler"; }
+		static int constexpr no_history_components = 0;
+		static bool constexpr staggered = false;
+		static void synchronise(Particle &, float const) {}
+
+		static void step(Particle & p, float *, float const dt)
+		{
+			glm::vec3 new_velocity = p.velocity + p.acc*dt;
+			glm::vec3 new_position = p.position + new_velocity*dt;
+			p.position = new_position;
+			p.velocity = new_velocity;
+		}
+	};
+
+	// position update of velocity Verlet, O(dt^3) per step; velocity is the secant of the step (v + a dt / 2)
+	struct VelocityVerlet
+	{
+		static char const * name() { return "velocity Verlet"; }
+		static int constexpr no_history_components = 0;
+		static bool constexpr staggered = false;
+		static void synchronise(Particle &, float const) {}
+
+		static void step(Particle & p, float *, float const dt)
+		{
+			glm::vec3 new_position = p.position + p.velocity*dt + 0.5f*p.acc*dt*dt;
+			glm::vec3 new_velocity = (new_position - p.position) / dt;
+			p.position = new_position;
+			p.velocity = new_velocity;
+		}
+	};
+
+	/**
+	 * Kick-drift-kick: http://einstein.drexel.edu/courses/Comp_Phys/Integrators/leapfrog/
+	 * With one force evaluation per step the closing half kick of a step and the opening one
+	 * of the next are a single full kick, so particle velocities live at half steps, v(t + dt/2).
+	 * history[0]	0 for a particle which has not been kicked yet: it gets the opening half kick only
+	 */
+	struct LeapfrogKDK
+	{
+		static char const * name() { return "leapfrog KDK"; }
+		static int constexpr no_history_components = 1;
+		static bool constexpr staggered = true;
+
+		static void step(Particle & p, float * history, float const dt)
+		{
+			float const kick = history[0] != 0.0f ? dt : 0.5f*dt;
+			history[0] = 1.0f;
+			p.velocity += p.acc*kick;
+			p.position += p.velocity*dt;
+		}
+
+		// back to the start of the step, exact: x(t) = x - v(t + dt/2) dt, v(t) = v(t + dt/2) - a(t) dt / 2
+		static void synchronise(Particle & p, float const dt)
+		{
+			p.position -= p.velocity*dt;
+			p.velocity -= 0.5f*p.acc*dt;
+		}
+	};
+
+	/**
+	 * Adams-Bashforth 2 for velocity, trapezoidal rule over the old and new velocity for position;
+	 * second order, needs the acceleration of the previous step instead of forces at a predicted state
+	 * (no corrector pass, so not a predictor-corrector).
+	 * history[0..2]	previous acceleration, history[3]	0 before the first step (then AB2 falls back to Euler)
+	 */
+	struct AdamsBashforth2
+	{
+		static char const * name() { return "Adams-Bashforth 2"; }
+		static int constexpr no_history_components = 4;
+		static bool constexpr staggered = false;
+		static void synchronise(Particle &, float const) {}
+
+		static void step(Particle & p, float * history, float const dt)
+		{
+			glm::vec3 const previous_acc = history[3] != 0.0f ? glm::vec3(history[0], history[1], history[2]) : p.acc;
+			glm::vec3 const new_velocity = p.velocity + (1.5f*p.acc - 0.5f*previous_acc)*dt;
+			p.position += 0.5f*(p.velocity + new_velocity)*dt;
+			p.velocity = new_velocity;
+
+			history[0] = p.acc.x;
+			history[1] = p.acc.y;
+			history[2] = p.acc.z;
+			history[3] = 1.0f;
+		}
+	};
+}
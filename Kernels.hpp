@@ -0,0 +1,92 @@
+#pragma once
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "Dimension.hpp"
+#include "MathTier.hpp"
+
+/**
+ * SPH smoothing kernels for any support radius h (Grid cells are c::H wide; neighbour searches
+ * reach ceil(h / cell size) cells around a particle, see Grid::get_reach()).
+ * Pairs of particles with different Particle::h use the symmetric h (see symmetric()),
+ * which keeps forces antisymmetric and momentum conserved.
+ * Coefficients for h == c::H are computed once; other radii pay for the pow().
+ * Normalisations follow c::dimensions (see dimension::Traits), per-pair arithmetic c::math_tier
+ * (Math, see math_tier::; other tiers are instantiated by Simulation::report_math_tiers()).
+ * Real is float, or double for precision::Double; normalisations are float in both.
+ */
+namespace kernel
+{
+	// support radius of a pair
+	inline float symmetric(float const h_i, float const h_j)
+	{
+		return 0.5f * (h_i + h_j);
+	}
+
+	template<typename Math = math_tier::Current, typename Real>
+	inline Real W_poly6(Real const r_sq, Real const h_sq, Real const h)
+	{
+		static float const coefficient_H = dimension::Current::poly6(c::H);
+		Real const coefficient = h == c::H ? coefficient_H : dimension::Current::poly6(static_cast<float>(h));
+
+		return coefficient * Math::cube(h_sq - r_sq);
+	}
+
+	// times rVec
+	template<typename Math = math_tier::Current, typename Real>
+	inline Real GradW_poly6(Real const r, Real const h)
+	{
+		static float const coefficient_H = dimension::Current::poly6_gradient(c::H);
+		Real const coefficient = h == c::H ? coefficient_H : dimension::Current::poly6_gradient(static_cast<float>(h));
+
+		return static_cast<Real>(coefficient * Math::square(Math::square(h) - Math::square(r)));
+	}
+
+	// for the surface tension color field
+	template<typename Math = math_tier::Current, typename Real>
+	inline Real LapW_poly6(Real const r, Real const h)
+	{
+		static float const coefficient_H = dimension::Current::poly6_gradient(c::H);
+		Real const coefficient = h == c::H ? coefficient_H : dimension::Current::poly6_gradient(static_cast<float>(h));
+
+		return static_cast<Real>(coefficient * (Math::square(h) - Math::square(r)) * dimension::Current::poly6_laplacian_shape(h, r));
+	}
+
+	// times rVec
+	template<typename Math = math_tier::Current, typename Real>
+	inline Real GradW_spiky(Real const r, Real const h)
+	{
+		static float const coefficient_H = dimension::Current::spiky_gradient(c::H);
+		Real const coefficient = h == c::H ? coefficient_H : dimension::Current::spiky_gradient(static_cast<float>(h));
+
+		return static_cast<Real>(coefficient * Math::square(h - r) / r);
+	}
+
+	inline float LapW_viscosity(float const r, float const h)
+	{
+		static float const coefficient_H = dimension::Current::viscosity_laplacian(c::H);
+		float const coefficient = h == c::H ? coefficient_H : dimension::Current::viscosity_laplacian(h);
+
+		return coefficient * (h - r);
+	}
+
+	// Vector - glm::vec3 or glm::dvec3, see precision::
+	template<typename Math = math_tier::Current, typename Vector>
+	inline Vector Grad_BicubicSpline(Vector const x, float const h)
+	{
+		auto const r = Math::length(x);
+		auto const q = r / h;
+		auto coefficient = dimension::Current::spline_gradient(h);
+
+		if(0.0f <= q && q <= 0.5f)
+			coefficient *= 3.0f * Math::square(q) - 2.0f * q;
+		else if(0.5f < q && q <= 1.0f)
+			coefficient *= -1.0f * Math::square(1.0f - q);
+		else
+			coefficient *= 0.0f;
+
+		return Vector(coefficient) * Math::normalize(x) / Vector(h);
+	}
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "LoadBalancer.hpp"
+
+
+LoadBalancer::LoadBalancer() : _no_threads(omp_get_max_threads()), no_loops(0)
+{
+	queues.reset(new WorkQueue[_no_threads]);
+	runs.assign(_no_threads, std::make_pair(0, 0));
+	reset_stats();
+}
+
+void LoadBalancer::partition(std::array<int, c::C + 1> const & particle_offsets)
+{
+	int const total_particles = particle_offsets[c::C];
+	int const chunk_target = std::max(1, total_particles / (_no_threads * c::chunks_per_thread));
+
+	// cut a new chunk whenever cumulative particle count crosses the next multiple of chunk_target
+	chunks.clear();
+	int first_cell = 0;
+	for(int idx = 0; idx < c::C; ++idx)
+	{
+		int const no_particles = particle_offsets[idx + 1] - particle_offsets[first_cell];
+		if(no_particles >= chunk_target || idx == c::C - 1)
+		{
+			chunks.push_back({ first_cell, idx + 1, no_particles });
+			first_cell = idx + 1;
+		}
+	}
+
+	// every thread gets a contiguous run of chunks with ~total/_no_threads particles
+	int chunk = 0;
+	for(int t = 0; t < _no_threads; ++t)
+	{
+		int const run_begin = chunk;
+		long long const run_end_particles = static_cast<long long>(total_particles) * (t + 1) / _no_threads;
+
+		while(chunk < static_cast<int>(chunks.size()) && (particle_offsets[chunks[chunk].last_cell] <= run_end_particles || t == _no_threads - 1))
+			++chunk;
+
+		runs[t] = std::make_pair(run_begin, chunk);
+	}
+}
+
+void LoadBalancer::refill_queues()
+{
+	for(int t = 0; t < _no_threads; ++t)
+		queues[t].range.store(pack(runs[t].first, runs[t].second), std::memory_order_relaxed);
+}
+
+bool LoadBalancer::pop_head(WorkQueue & q, int & chunk)
+{
+	uint64_t range = q.range.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		uint32_t const head = static_cast<uint32_t>(range);
+		uint32_t const tail = static_cast<uint32_t>(range >> 32);
+		if(head >= tail)
+			return false;
+
+		if(q.range.compare_exchange_weak(range, pack(head + 1, tail), std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			chunk = static_cast<int>(head);
+			return true;
+		}
+	}
+}
+
+bool LoadBalancer::pop_tail(WorkQueue & q, int & chunk)
+{
+	uint64_t range = q.range.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		uint32_t const head = static_cast<uint32_t>(range);
+		uint32_t const tail = static_cast<uint32_t>(range >> 32);
+		if(head >= tail)
+			return false;
+
+		if(q.range.compare_exchange_weak(range, pack(head, tail - 1), std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			chunk = static_cast<int>(tail - 1);
+			return true;
+		}
+	}
+}
+
+void LoadBalancer::reset_stats()
+{
+	stats.assign(_no_threads, ThreadStats());
+	no_loops = 0;
+}
+
+void LoadBalancer::report_utilisation(std::ostream & os) const
+{
+	double max_busy = 0.0, sum_busy = 0.0;
+	for(auto const & s : stats)
+	{
+		max_busy = std::max(max_busy, s.busy_time);
+		sum_busy += s.busy_time;
+	}
+	double const mean_busy = sum_busy / _no_threads;
+
+	os << "load balance: " << _no_threads << " threads, " << no_loops << " cell loops, " << chunks.size() << " chunks\n";
+	os << " thread   busy[ms]  utilisation  particles    chunks    stolen\n";
+	for(int t = 0; t < _no_threads; ++t)
+	{
+		auto const & s = stats[t];
+		double const utilisation = s.region_time > 0.0 ? s.busy_time / s.region_time : 0.0;
+
+		os << std::setw(7) << t
+			<< std::setw(11) << std::fixed << std::setprecision(2) << s.busy_time * 1000.0
+			<< std::setw(12) << std::setprecision(1) << utilisation * 100.0 << "%"
+			<< std::setw(11) << s.no_particles
+			<< std::setw(10) << s.no_chunks
+			<< std::setw(10) << s.no_stolen_chunks << "\n";
+	}
+	// 1.0 == perfect balance; parallel efficiency of cell loops is bounded by this value
+	os << " balance (mean/max busy): " << std::setprecision(3) << (max_busy > 0.0 ? mean_busy / max_busy : 1.0) << std::endl;
+}
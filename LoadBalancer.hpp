@@ -0,0 +1,144 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <omp.h>
+
+#include "constants.hpp"
+
+/**
+ * Contiguous range of grid cells [first_cell, last_cell) holding roughly
+ * the same number of particles as every other chunk.
+ */
+struct WorkChunk
+{
+	int first_cell;
+	int last_cell;
+	int no_particles;
+};
+
+/**
+ * Accumulated per-thread counters used for the utilisation report.
+ * busy_time	time spent inside chunks [s]
+ * region_time	wall time of parallel regions the thread took part in [s]
+ */
+struct ThreadStats
+{
+	double busy_time;
+	double region_time;
+	long long no_particles;
+	long long no_chunks;
+	long long no_stolen_chunks;
+	char padding[24];// one cache line per thread
+};
+
+/**
+ * Schedules loops over Grid cells on all OpenMP threads.
+ * Cells are grouped into chunks by cumulative particle count (prefix sums from
+ * Simulation::bin_particles_in_grid()), so a dam break (whole fluid column in a
+ * few cells) is spread evenly. Every thread gets a contiguous run of chunks
+ * (keeps the sorted particle memory local); a thread which runs out of work
+ * steals chunks from the back of other threads' runs.
+ */
+class LoadBalancer
+{
+public:
+	LoadBalancer();
+
+	/**
+	 * Rebuilds chunks and per-thread queues.
+	 * @param particle_offsets	exclusive prefix sum of particles per cell; particle_offsets[c::C] == total
+	 */
+	void partition(std::array<int, c::C + 1> const & particle_offsets);
+
+	/**
+	 * Calls cell_function(cell_index) for every cell of the grid, in parallel.
+	 * Must NOT be called from inside an omp parallel region.
+	 */
+	template<typename CellFunction>
+	void for_each_cell(CellFunction cell_function);
+
+	void report_utilisation(std::ostream & os) const;
+	void reset_stats();
+
+	int no_threads() const { return _no_threads; }
+
+private:
+	// head (low 32 bits) and tail (high 32 bits) of a thread's chunk run packed in one word,
+	// so owner (pops head) and thieves (pop tail) synchronize with a single CAS
+	struct WorkQueue
+	{
+		std::atomic<uint64_t> range;
+		char padding[64 - sizeof(std::atomic<uint64_t>)];// no false sharing between queues
+	};
+
+	static uint64_t pack(uint32_t head, uint32_t tail) { return static_cast<uint64_t>(head) | (static_cast<uint64_t>(tail) << 32); }
+	void refill_queues();
+	bool pop_head(WorkQueue & q, int & chunk);
+	bool pop_tail(WorkQueue & q, int & chunk);
+
+	template<typename CellFunction>
+	void process_chunk(int chunk, int thread_id, CellFunction & cell_function);
+
+	int _no_threads;
+	std::vector<WorkChunk> chunks;
+	std::vector<std::pair<int, int> > runs;// initial [head, tail) of every thread's queue
+	std::unique_ptr<WorkQueue[]> queues;
+	std::vector<ThreadStats> stats;
+	long long no_loops;
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename CellFunction>
+void LoadBalancer::process_chunk(int chunk, int thread_id, CellFunction & cell_function)
+{
+	auto const & work = chunks[chunk];
+	for(int idx = work.first_cell; idx < work.last_cell; ++idx)
+		cell_function(idx);
+
+	stats[thread_id].no_particles += work.no_particles;
+	++stats[thread_id].no_chunks;
+}
+
+template<typename CellFunction>
+void LoadBalancer::for_each_cell(CellFunction cell_function)
+{
+	++no_loops;
+	refill_queues();
+
+	#pragma omp parallel num_threads(_no_threads) default(shared)
+	{
+		int const thread_id = omp_get_thread_num();
+		double const region_start = omp_get_wtime();
+		int chunk;
+
+		// own run first: front to back, keeps cache locality of sorted particles
+		while(pop_head(queues[thread_id], chunk))
+			process_chunk(chunk, thread_id, cell_function);
+
+		// then steal from the back of other runs; if the team is smaller than _no_threads,
+		// queues of absent threads are drained this way as well
+		for(int offset = 1; offset < _no_threads; ++offset)
+		{
+			auto & victim = queues[(thread_id + offset) % _no_threads];
+			while(pop_tail(victim, chunk))
+			{
+				process_chunk(chunk, thread_id, cell_function);
+				++stats[thread_id].no_stolen_chunks;
+			}
+		}
+
+		double const busy_end = omp_get_wtime();
+		stats[thread_id].busy_time += busy_end - region_start;
+
+		#pragma omp barrier
+
+		stats[thread_id].region_time += omp_get_wtime() - region_start;
+	}
+}
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <SOIL.h>
 
 #include <stdlib.h> //realpath
@@ -9,6 +11,7 @@
 #include "Painter.hpp"
 #include "ParticleSystem.hpp"
 #include "Grid.hpp"
+#include "Kernels.hpp"
 #include "MarchingCubes.h"
 #include "constants.hpp"
 #include "MCMesh.hpp"
@@ -66,25 +69,31 @@ void MCMesh::setup_buffers(void)
 	loadTextures();
 }
 
-namespace kernel
-{
-	float W_poly6(float r_sq, float h_sq, float h)
-	{
-		static float coefficient = 315.0f / (64.0f*c::PIf*pow(h, 9));
-
-		return coefficient * pow(h_sq - r_sq, 3);
-	}
-}
-
-void MCMesh::generate_mesh(std::array<GridCell, c::C> const & grid)
+void MCMesh::generate_mesh(std::array<GridCell, c::C> const & grid, std::vector<Particle> const & particles, std::vector<int> const & surface_slots)
 {
 	using particle_system::get_cell_index;
 	using particle_system::out_of_grid_scope;
 	using namespace c;
 
-	auto const h_sq = c::H*c::H;
 	auto const MCGridSize = (c::voxelGridDimension + 1) * (c::voxelGridDimension + 1) * (c::voxelGridDimension + 1);
 	auto xyzw_data = make_unique<glm::vec4[]>(MCGridSize);
+	float minValue = 15.0f;
+
+	// vertices within c::H of a surface particle - the only ones where the field can cross minValue
+	int const no_vertices_per_axis = c::voxelGridDimension + 1;
+	int const reach = static_cast<int>(std::ceil(c::H / c::voxelSize));
+	std::vector<char> near_surface(MCGridSize, 0);
+	for(int const slot : surface_slots)
+	{
+		glm::vec3 const first = glm::floor((particles[slot].position - glm::vec3(c::xyzminV)) / c::voxelSize) - glm::vec3(static_cast<float>(reach));
+		int const first_k = std::max(static_cast<int>(first.x), 0), last_k = std::min(static_cast<int>(first.x) + 2 * reach + 1, no_vertices_per_axis - 1);
+		int const first_j = std::max(static_cast<int>(first.y), 0), last_j = std::min(static_cast<int>(first.y) + 2 * reach + 1, no_vertices_per_axis - 1);
+		int const first_i = std::max(static_cast<int>(first.z), 0), last_i = std::min(static_cast<int>(first.z) + 2 * reach + 1, no_vertices_per_axis - 1);
+		for(int i = first_i; i <= last_i; ++i)
+			for(int j = first_j; j <= last_j; ++j)
+				for(int k = first_k; k <= last_k; ++k)
+					near_surface[k + j*no_vertices_per_axis + i*no_vertices_per_axis*no_vertices_per_axis] = 1;
+	}
 
 	for(int i = 0; i < c::voxelGridDimension + 1; i++)
 	{
@@ -96,6 +105,14 @@ void MCMesh::generate_mesh(std::array<GridCell, c::C> const & grid)
 				auto cell_vertex_position = glm::vec3(c::xyzminV + static_cast<float>(k)*c::voxelSize, c::xyzminV + static_cast<float>(j) *c::voxelSize, c::xyzminV + static_cast<float>(i) *c::voxelSize);
 				auto density = 0.0f;
 
+				// away from the surface only inside (occupied Grid cell) or outside matters
+				if(!near_surface[idx])
+				{
+					bool const inside = !out_of_grid_scope(cell_vertex_position) && grid[get_cell_index(cell_vertex_position)].no_particles > 0;
+					xyzw_data[idx] = glm::vec4(cell_vertex_position, inside ? 2.0f*minValue : 0.0f);
+					continue;
+				}
+
 				// get potential (density) from neighbouring 8 cells (voxels)
 				// to create 3D scalar field on which Marching Cubes can run
 				for(auto x = -0.5f; x < 1.0f; x = x + 1.0f) // x < 1.0f zeby na pewno zaliczyc -0.5 i 0.5
@@ -122,13 +139,13 @@ void MCMesh::generate_mesh(std::array<GridCell, c::C> const & grid)
 								glm::vec3 rVec = cell_vertex_position - particle.position;
 								float r_sq = dot(rVec, rVec);
 
-								if(r_sq > h_sq)
+								if(r_sq > particle.h*particle.h)
 								{
 									++particle_ptr;
 									continue;
 								}
 
-								density += c::particleMass*kernel::W_poly6(r_sq, h_sq, c::H);
+								density += particle.mass*kernel::W_poly6(r_sq, particle.h*particle.h, particle.h);
 
 								++particle_ptr;
 							}
@@ -142,7 +159,6 @@ void MCMesh::generate_mesh(std::array<GridCell, c::C> const & grid)
 	}
 
 	int no_triangles = 0;
-	float minValue = 15.0f;
 
 	auto triangles = MarchingCubes(c::voxelGridDimension, c::voxelGridDimension, c::voxelGridDimension, c::voxelSize, c::voxelSize, c::voxelSize, minValue, std::move(xyzw_data), no_triangles);
 
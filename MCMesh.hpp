@@ -12,6 +12,7 @@ struct Vertex
 };
 
 struct GridCell;
+struct Particle;
 
 /**
  * MCMesh stands for: 'generate a Mesh using Marching Cubes and save to .obj'
@@ -34,7 +35,9 @@ public:
 	// stworzonej w petli symulacji.
 	// siatka tworzona przy pomocy Marching Cubes.
 	// po stworzeniu siatki aktualizowany jest bufor VBO na GPU
-	void generate_mesh(std::array<GridCell, c::C> const & grid);
+	// density is evaluated only within c::H of surface_slots (see Simulation::get_surface_slots()),
+	// elsewhere the field is inside or outside by Grid cell occupancy
+	void generate_mesh(std::array<GridCell, c::C> const & grid, std::vector<Particle> const & particles, std::vector<int> const & surface_slots);
 
 	GLsizei no_vertices;
 
@@ -0,0 +1,79 @@
+#pragma once
+#include <cmath>
+#include <xmmintrin.h>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+/**
+ * Precision tiers of the per-pair arithmetic in kernel:: and the neighbour loops (chosen by c::math_tier,
+ * see Simulation::report_math_tiers() for the error each one makes against Exact).
+ * Every tier has:
+ * name()	for reports
+ * sqrt(x), length(v), normalize(v)	distance of a pair and its direction
+ * square(x), cube(x)	powers of the kernels; Exact keeps pow() (double results), the others multiply in float
+ */
+namespace math_tier
+{
+	// IEEE sqrt and pow, as the kernels were written
+	struct Exact
+	{
+		static char const * name() { return "exact"; }
+
+		// also in double (precision::Double)
+		template<typename T>
+		static T sqrt(T const x) { return std::sqrt(x); }
+		template<typename Vector>
+		static auto length(Vector const v) { return glm::length(v); }
+		template<typename Vector>
+		static Vector normalize(Vector const v) { return glm::normalize(v); }
+		template<typename T>
+		static auto square(T const x) { return pow(x, 2); }
+		template<typename T>
+		static auto cube(T const x) { return pow(x, 3); }
+	};
+
+	// SSE reciprocal square root estimate (12 bits) refined by no_newton_steps Newton-Raphson steps (~22 bits after one)
+	template<int no_newton_steps>
+	struct ReciprocalSqrt
+	{
+		static float rsqrt(float const x)
+		{
+			float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+			for(int i = 0; i < no_newton_steps; ++i)
+				y = y * (1.5f - 0.5f*x*y*y);
+			return y;
+		}
+
+		// 0 for x == 0 (the estimate of 1/sqrt(0) is inf)
+		static float sqrt(float const x) { return x > 0.0f ? x*rsqrt(x) : 0.0f; }
+		static float length(glm::vec3 const v) { return sqrt(glm::dot(v, v)); }
+		static glm::vec3 normalize(glm::vec3 const v) { return v*rsqrt(glm::dot(v, v)); }
+		template<typename T>
+		static T square(T const x) { return x*x; }
+		template<typename T>
+		static T cube(T const x) { return x*x*x; }
+	};
+
+	struct NewtonRsqrt : ReciprocalSqrt<1>
+	{
+		static char const * name() { return "rsqrt + Newton"; }
+	};
+
+	struct Approximate : ReciprocalSqrt<0>
+	{
+		static char const * name() { return "approximate"; }
+	};
+
+	template<int Tier>
+	struct Select;
+	template<>
+	struct Select<c::EXACT_MATH> { using type = Exact; };
+	template<>
+	struct Select<c::NEWTON_RSQRT_MATH> { using type = NewtonRsqrt; };
+	template<>
+	struct Select<c::APPROXIMATE_MATH> { using type = Approximate; };
+
+	using Current = Select<c::math_tier>::type;
+}
@@ -0,0 +1,59 @@
+#include <cfloat>
+#include <utility>
+
+#include "MovingBoundary.hpp"
+
+
+MovingBoundary::MovingBoundary(glm::vec3 const local_min, glm::vec3 const local_max, Motion motion)
+	: shape(local_min - glm::vec3(2.0f * c::H), local_max + glm::vec3(2.0f * c::H)), motion(std::move(motion)),
+	local_min(local_min), local_max(local_max), step(c::dt),
+	first_cell(0), last_cell(-1), previous_first_cell(0), previous_last_cell(-1)// empty ranges - nothing covered yet
+{
+}
+
+bool MovingBoundary::update(float const time, float const dt)
+{
+	step = dt;
+	previous_to_world = motion(time - dt);
+	to_world = motion(time);
+	to_local = glm::inverse(to_world);
+
+	// world bounds of the local box, grown by the kernel radius
+	glm::vec3 world_min(FLT_MAX), world_max(-FLT_MAX);
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 const local_corner((corner & 1) ? local_max.x : local_min.x, (corner & 2) ? local_max.y : local_min.y, (corner & 4) ? local_max.z : local_min.z);
+		glm::vec3 const world_corner(to_world * glm::vec4(local_corner, 1.0f));
+		world_min = glm::min(world_min, world_corner);
+		world_max = glm::max(world_max, world_corner);
+	}
+	world_min -= glm::vec3(c::H);
+	world_max += glm::vec3(c::H);
+
+	glm::vec3 const grid_min(c::xmin, c::ymin, c::zmin), cell_size(c::dx, c::dy, c::dz);
+	glm::ivec3 const max_cell(c::K - 1, c::L - 1, c::M - 1);
+	glm::ivec3 const new_first_cell = glm::clamp(glm::ivec3(glm::floor((world_min - grid_min) / cell_size)), glm::ivec3(0), max_cell);
+	glm::ivec3 const new_last_cell = glm::clamp(glm::ivec3(glm::floor((world_max - grid_min) / cell_size)), glm::ivec3(0), max_cell);
+
+	previous_first_cell = first_cell;
+	previous_last_cell = last_cell;
+	first_cell = new_first_cell;
+	last_cell = new_last_cell;
+
+	return first_cell != previous_first_cell || last_cell != previous_last_cell;
+}
+
+bool MovingBoundary::sample(glm::vec3 const p, float & distance, glm::vec3 & normal, glm::vec3 & velocity) const
+{
+	glm::vec3 const local(to_local * glm::vec4(p, 1.0f));
+	if(glm::any(glm::lessThan(local, local_min - glm::vec3(c::H))) || glm::any(glm::greaterThan(local, local_max + glm::vec3(c::H))))
+		return false;
+
+	glm::vec3 local_normal;
+	shape.sample(local, distance, local_normal);
+
+	// rigid transform: rotation part turns normals as well
+	normal = glm::mat3(to_world) * local_normal;
+	velocity = (p - glm::vec3(previous_to_world * glm::vec4(local, 1.0f))) / step;
+	return true;
+}
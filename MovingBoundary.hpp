@@ -0,0 +1,63 @@
+#pragma once
+#include <functional>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "BoundarySDF.hpp"
+
+/**
+ * Kinematic (animated) rigid obstacle: piston, paddle, sloshing tank wall...
+ * Its shape is a distance field in body local coordinates, built once;
+ * every step only the body-to-world transform is evaluated, nothing is resampled.
+ *
+ * Usage: MovingBoundary body(local_min, local_max, motion);
+ *	body.get_shape().add_*_obstacle(...) (local coordinates); body.get_shape().finalize();
+ *
+ * @param motion	body-to-world transform as a function of simulation time (rigid: rotation + translation)
+ * @param first_cell, last_cell	inclusive range of grid cells which may hold particles within c::H of the body;
+ 	changes only when the body crosses cell borders (see Grid::cover_cells)
+ */
+class MovingBoundary
+{
+public:
+	using Motion = std::function<glm::mat4(float time)>;
+
+	// body must stay inside [local_min, local_max] in its local coordinates
+	MovingBoundary(glm::vec3 const local_min, glm::vec3 const local_max, Motion motion);
+
+	BoundarySDF & get_shape() { return shape; }
+
+	/**
+	 * Evaluates the transform at time (and at time - dt, for wall velocity).
+	 * @return	true if the range of cells near the body changed
+	 */
+	bool update(float const time, float const dt);
+
+	/**
+	 * @param distance	signed distance to the body surface (< 0 inside)
+	 * @param normal	unit vector pointing out of the body, world coordinates
+	 * @param velocity	velocity of the body point coinciding with p
+	 * @return	false if p is too far from the body to be affected (outputs not written)
+	 */
+	bool sample(glm::vec3 const p, float & distance, glm::vec3 & normal, glm::vec3 & velocity) const;
+
+	glm::ivec3 get_first_cell() const { return first_cell; }
+	glm::ivec3 get_last_cell() const { return last_cell; }
+	glm::ivec3 get_previous_first_cell() const { return previous_first_cell; }
+	glm::ivec3 get_previous_last_cell() const { return previous_last_cell; }
+
+private:
+	BoundarySDF shape;
+	Motion motion;
+	glm::vec3 local_min;
+	glm::vec3 local_max;
+
+	glm::mat4 to_world;
+	glm::mat4 to_local;
+	glm::mat4 previous_to_world;
+	float step;
+
+	glm::ivec3 first_cell, last_cell;
+	glm::ivec3 previous_first_cell, previous_last_cell;
+};
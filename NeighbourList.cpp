@@ -0,0 +1,43 @@
+#include <algorithm>
+
+#include "NeighbourList.hpp"
+
+
+NeighbourList::NeighbourList() : no_buffers(0), offsets(1, 0)
+{
+}
+
+void NeighbourList::reset(int const no_particles, int const no_threads)
+{
+	if(no_threads != no_buffers)
+	{
+		buffers = std::make_unique<ThreadBuffer[]>(no_threads);
+		no_buffers = no_threads;
+	}
+	for(int t = 0; t < no_buffers; ++t)
+		buffers[t].entries.clear();// capacity is kept from step to step
+
+	// rows never ended (no particle in the slot) stay empty
+	row_thread.assign(no_particles, 0);
+	row_first.assign(no_particles, 0);
+	row_size.assign(no_particles, 0);
+}
+
+void NeighbourList::finalize()
+{
+	int const no_particles = static_cast<int>(row_size.size());
+
+	offsets.resize(no_particles + 1);
+	offsets[0] = 0;
+	for(int slot = 0; slot < no_particles; ++slot)
+		offsets[slot + 1] = offsets[slot] + row_size[slot];
+
+	neighbours.resize(offsets[no_particles]);
+
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		auto const first = buffers[row_thread[slot]].entries.begin() + row_first[slot];
+		std::copy(first, first + row_size[slot], neighbours.begin() + offsets[slot]);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+/**
+ * Fluid neighbour of a particle.
+ * slot	index in ParticleSystem::particles
+ * r	distance (minimum image), within the support radius of the pair (kernel::symmetric())
+ */
+struct Neighbour
+{
+	int slot;
+	float r;
+};
+
+/**
+ * Neighbours of every live particle in compressed rows (CSR): neighbours of slot i are
+ * [offsets[i], offsets[i + 1]) of neighbours, in the order of the grid traversal; a particle is
+ * not its own neighbour. Filled by the density pass (first traversal after the sort),
+ * so later passes and iterative solves of the same step do not search the grid again.
+ * Valid until the next sort step.
+ *
+ * Building, from a parallel loop where every row is written by one thread:
+ *	reset(); row = start_row(thread); add(thread, ...)...; end_row(thread, slot, row); ...; finalize();
+ */
+class NeighbourList
+{
+public:
+	NeighbourList();
+
+	void reset(int const no_particles, int const no_threads);
+
+	// @return	row handle for end_row()
+	int start_row(int const thread_id) const { return static_cast<int>(buffers[thread_id].entries.size()); }
+	void add(int const thread_id, int const slot, float const r) { buffers[thread_id].entries.push_back({ slot, r }); }
+	void end_row(int const thread_id, int const slot, int const row) { row_thread[slot] = thread_id; row_first[slot] = row; row_size[slot] = start_row(thread_id) - row; }
+
+	// gathers rows from per-thread buffers into CSR arrays
+	void finalize();
+
+	int get_no_particles() const { return static_cast<int>(offsets.size()) - 1; }
+	int get_no_pairs() const { return offsets.back(); }
+	std::vector<int> const & get_offsets() const { return offsets; }
+	std::vector<Neighbour> const & get_neighbours() const { return neighbours; }
+
+private:
+	// rows are appended here while the grid is traversed
+	struct ThreadBuffer
+	{
+		std::vector<Neighbour> entries;
+		char padding[64 - sizeof(std::vector<Neighbour>)];// no false sharing between threads appending
+	};
+
+	std::unique_ptr<ThreadBuffer[]> buffers;
+	int no_buffers;
+	std::vector<int> row_thread;
+	std::vector<int> row_first;
+	std::vector<int> row_size;
+
+	std::vector<int> offsets;// [no_particles + 1]
+	std::vector<Neighbour> neighbours;
+};
@@ -1,3 +1,4 @@
+#include "Random.hpp"
 #include "Particle.hpp"
 
 int Particle::no_particles;
@@ -6,22 +7,27 @@ Particle::Particle()
 {
 	using namespace c;
 
-	position.x = RANDOM(xmin, xmax);
-	position.y = RANDOM(ymin, ymax);
-	position.z = RANDOM(zmin, zmax);
-	nutrient = 0.0f;
-	color_field_gradient_magnitude = 0.0f;
 	id = no_particles;
 	++no_particles;
+	position.x = rng::uniform(rng::PARTICLE_POSITION_X, id, xmin, xmax);
+	position.y = rng::uniform(rng::PARTICLE_POSITION_Y, id, ymin, ymax);
+	position.z = rng::uniform(rng::PARTICLE_POSITION_Z, id, zmin, zmax);
+	h = H;
+	mass = particleMass;
+	alive = true;
 }
 
-Particle::Particle(const glm::vec3 pos, const glm::vec3 velo)
+Particle::Particle(const glm::vec3 pos, const glm::vec3 velo) : Particle(pos, velo, no_particles++)
+{
+}
+
+Particle::Particle(const glm::vec3 pos, const glm::vec3 velo, int const id)
 {
 	position = pos;
 	velocity = velo;
-	nutrient = 0.0f;
 	density = 998.29f;
-	color_field_gradient_magnitude = 0.0f;
-	id = no_particles;
-	++no_particles;
+	h = c::H;
+	mass = c::particleMass;
+	alive = true;
+	this->id = id;
 }
\ No newline at end of file
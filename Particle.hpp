@@ -2,31 +2,22 @@
 #include <glm/glm.hpp>
 #include "constants.hpp"
 
-#define RANDOM(MIN, MAX) (MIN) + static_cast<float>(rand()) /(static_cast<float>(RAND_MAX/((MAX)-(MIN))))
-
 struct Particle
 {
 	Particle();
 	Particle(const glm::vec3 pos, const glm::vec3 velo);
-
-	void add_nutrient(float nut)
-	{
-		nutrient += nut;
-	}
+	Particle(const glm::vec3 pos, const glm::vec3 velo, int const id);
 
 	glm::vec3 position;
-	//glm::vec3 previous_position;
 	glm::vec3 velocity;
-	//glm::vec3 eval_velocity;
 	glm::vec3 acc;
-	glm::vec3 force;
-	float nutrient;
-	float new_nutrient;
 	float density;
 	float pressure;
-	float color_field_gradient_magnitude;
+	float h;// support radius; pairs use kernel::symmetric()
+	float mass;
 	bool at_surface;
+	bool alive;// false - killed, slot waits in ParticleSystem free list
 
-	int id;
-	static int no_particles;
+	int id;// unique for the whole run, never reused (see ParticleSystem::get_slot())
+	static int no_particles;// ids handed out so far
 };
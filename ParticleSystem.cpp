@@ -1,7 +1,12 @@
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cassert>
 #include <numeric>
+#include <omp.h>
 
+#include "Dimension.hpp"
 #include "Painter.hpp"
+#include "Random.hpp"
 #include "SphereModel.hpp"
 #include "ParticleSystem.hpp"
 
@@ -23,6 +28,13 @@ namespace particle_system
 	//	return static_cast<int>(get_z_index(get_grid_coords(v)));
 	//}
 
+	// cell index, in deterministic mode ties broken by id - order in a cell does not depend on history
+	int64_t get_sort_key(Particle const & p)
+	{
+		int64_t const cell = get_cell_index(p.position);
+		return c::deterministic ? cell * (int64_t(1) << 32) + p.id : cell;
+	}
+
 	inline glm::ivec3 get_grid_coords(glm::vec3 const v)
 	{
 		return glm::ivec3(floor((v.x - c::xmin) / c::dx), floor((v.y - c::ymin) / c::dy), floor((v.z - c::zmin) / c::dz));
@@ -36,7 +48,50 @@ namespace particle_system
 	bool out_of_grid_scope(const glm::vec3 v)
 	{
 		using namespace c;
-		return v.x < xmin || v.x > xmax || v.y < ymin || v.y > ymax || v.z < zmin || v.z > zmax;
+		// same expressions as get_cell_index(): points within round-off of the max faces would get a cell past the last one
+		return v.x < xmin || (v.x - xmin) / dx >= K || v.y < ymin || (v.y - ymin) / dy >= L || v.z < zmin || (v.z - zmin) / dz >= M;
+	}
+
+	static_assert((!c::periodic_x || c::K >= 3) && (!c::periodic_y || c::L >= 3) && (!c::periodic_z || c::M >= 3),
+		"periodic axis with less than 3 cells would visit the same neighbour cell twice");
+
+	namespace
+	{
+		float wrap(float x, float min, float cell_size, int no_cells)
+		{
+			float const length = cell_size * no_cells;
+			x -= floor((x - min) / length) * length;
+			return (x - min) / cell_size < no_cells ? x : min;// round-off can leave x on the max face (see out_of_grid_scope)
+		}
+
+		float nearest_image(float r, float length)
+		{
+			return r - floor(r / length + 0.5f) * length;
+		}
+	}
+
+	glm::vec3 wrap_position(glm::vec3 v)
+	{
+		using namespace c;
+		if(periodic_x)
+			v.x = wrap(v.x, xmin, dx, K);
+		if(periodic_y)
+			v.y = wrap(v.y, ymin, dy, L);
+		if(periodic_z)
+			v.z = wrap(v.z, zmin, dz, M);
+		return v;
+	}
+
+	glm::vec3 minimum_image(glm::vec3 rVec)
+	{
+		using namespace c;
+		if(periodic_x)
+			rVec.x = nearest_image(rVec.x, xmax - xmin);
+		if(periodic_y)
+			rVec.y = nearest_image(rVec.y, ymax - ymin);
+		if(periodic_z)
+			rVec.z = nearest_image(rVec.z, zmax - zmin);
+		return rVec;
 	}
 
 	inline uint64_t get_z_index(glm::ivec3 const v)
@@ -64,14 +119,33 @@ namespace particle_system
 	}
 }
 
-ParticleSystem::ParticleSystem()
+namespace
+{
+	// unused slot; unlike Particle() takes no id (see Particle::no_particles)
+	Particle make_free_slot()
+	{
+		Particle free_slot(glm::vec3(0.0f), glm::vec3(0.0f), -1);
+		free_slot.alive = false;
+		return free_slot;
+	}
+} // namespace anonymous
+
+ParticleSystem::ParticleSystem() : color_channel(-1), no_killed(0)
 {
 	particles.resize(c::N);
+	for(int slot = 0; slot < c::N; ++slot)
+	{
+		if(particles[slot].id >= static_cast<int>(id_to_slot.size()))
+			id_to_slot.resize(particles[slot].id + 1, -1);
+		id_to_slot[particles[slot].id] = slot;
+	}
 	model_matrices.resize(c::N);
 	bin_idx.resize(c::N);
 	particle_color.resize(c::N);
 	surface_particles.resize(c::N);
 
+	color_field_gradient_magnitude_channel = register_channel("color_field_gradient_magnitude", 1, ChannelLayout::SCRATCH);
+
 	setup_buffers();
 }
 
@@ -93,7 +167,7 @@ void ParticleSystem::setup_buffers(void)
 		model = glm::scale(model, glm::vec3(0.02f));
 		model_matrices[index] = model;
 		bin_idx[index] = static_cast<float>(get_cell_index(particle_position));
-		particle_color[index] = compute_particle_color(p);
+		particle_color[index] = compute_particle_color(index);
 		surface_particles[index] = p.at_surface;
 		index++;
 	}
@@ -103,22 +177,22 @@ void ParticleSystem::setup_buffers(void)
 
 	glGenBuffers(1, &this->model_mat_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, this->model_mat_VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * particle_count, &this->model_matrices[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * particles.size(), &this->model_matrices[0], GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glGenBuffers(1, &this->bin_idx_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, this->bin_idx_VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * particle_count, &this->bin_idx[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * particles.size(), &this->bin_idx[0], GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glGenBuffers(1, &this->particle_color_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, this->particle_color_VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * particle_count, &this->particle_color[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * particles.size(), &this->particle_color[0], GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glGenBuffers(1, &this->at_surface_VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, this->at_surface_VBO); 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * particle_count, &this->surface_particles[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * particles.size(), &this->surface_particles[0], GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glGenBuffers(1, &this->VBO);
@@ -198,22 +272,25 @@ void ParticleSystem::reset_buffers()
 	setup_buffers();
 }
 
-void ParticleSystem::update_buffers()
+void ParticleSystem::update_buffers(unsigned const fields)
 {
 	using particle_system::get_cell_index;
 
-	int index = 0;
-	for(auto const & p : particles)
+	// GL buffers hold all slots; only live particles are uploaded and drawn
+	for(int index = 0; index < particle_count; ++index)
 	{
+		auto const & p = particles[index];
 		auto const particle_position = p.position;
 		glm::mat4 model;
 		model = glm::translate(model, particle_position);
 		model = glm::scale(model, glm::vec3(0.02f));
 		model_matrices[index] = model;
-		bin_idx[index] = static_cast<float>(get_cell_index(particle_position));
-		particle_color[index] = compute_particle_color(p);
-		surface_particles[index] = p.at_surface;
-		index++;
+		if(fields & BIN_INDEX)
+			bin_idx[index] = static_cast<float>(get_cell_index(particle_position));
+		if(fields & PARTICLE_COLOR)
+			particle_color[index] = compute_particle_color(index);
+		if(fields & SURFACE_FLAGS)
+			surface_particles[index] = p.at_surface;
 	}
 
 	// alternatywa: http://www.gamedev.net/topic/666461-map-buffer-range-super-slow/
@@ -222,49 +299,285 @@ void ParticleSystem::update_buffers()
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::mat4) * particle_count, &this->model_matrices[0]);// replace data in VBO with new data
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, this->bin_idx_VBO);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * particle_count, &this->bin_idx[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(fields & BIN_INDEX)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->bin_idx_VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * particle_count, &this->bin_idx[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, this->particle_color_VBO);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * particle_count, &this->particle_color[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(fields & PARTICLE_COLOR)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->particle_color_VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * particle_count, &this->particle_color[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, this->at_surface_VBO);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLuint) * particle_count, &this->surface_particles[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(fields & SURFACE_FLAGS)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->at_surface_VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLuint) * particle_count, &this->surface_particles[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 }
 
 std::unique_ptr<glm::vec4[]> ParticleSystem::get_position_color_field_data()
 {
 	auto position_color_field_data = make_unique<glm::vec4[]>(particle_count);
+	float const * color_field_gradient_magnitude = get_channel(color_field_gradient_magnitude_channel);
 	for(int i = 0; i < particle_count; ++i)
-		position_color_field_data[i] = glm::vec4(particles[i].position, particles[i].color_field_gradient_magnitude);
+		position_color_field_data[i] = glm::vec4(particles[i].position, color_field_gradient_magnitude[i]);
 	return position_color_field_data;
 }
 
-GLfloat ParticleSystem::compute_particle_color(Particle const & p)
+GLfloat ParticleSystem::compute_particle_color(int const slot) const
 {
-	static auto average = std::accumulate(particles.begin(), particles.end(), 0.0f, [](float const & sum, Particle const & p) { return sum + p.nutrient; }) / particles.size();
+	if(color_channel == -1)
+		return 0.0f;
+	return get_channel(color_channel)[slot * channels[color_channel].no_components];// * 1.5f
+}
+
+int ParticleSystem::register_channel(std::string const & name, int const no_components, ChannelLayout const layout, AttributeChannel::Initializer initialize)
+{
+	int const existing = find_channel(name);
+	if(existing != -1)
+		return existing;
+
+	channels.push_back({ name, no_components, layout, std::vector<float>(), std::move(initialize) });
+	resize_channels();
+	return static_cast<int>(channels.size()) - 1;
+}
 
-	return p.nutrient;// / average;// * 1.5f
+int ParticleSystem::find_channel(std::string const & name) const
+{
+	for(int handle = 0; handle < static_cast<int>(channels.size()); ++handle)
+		if(channels[handle].name == name)
+			return handle;
+	return -1;
+}
+
+void ParticleSystem::resize_channels()
+{
+	for(auto & channel : channels)
+	{
+		size_t const no_entries = channel.layout == ChannelLayout::BY_ID ? id_to_slot.size() : particles.size();
+		channel.values.resize(no_entries * channel.no_components, 0.0f);
+	}
+}
+
+void ParticleSystem::permute_sorted_channels()
+{
+	// id_to_slot still maps to slots from before compaction and sorting
+	for(auto & channel : channels)
+	{
+		if(channel.layout != ChannelLayout::SORTED)
+			continue;
+
+		int const no_components = channel.no_components;
+		permuted_values.resize(channel.values.size());
+
+		#pragma omp parallel for schedule(static)
+		for(int slot = 0; slot < particle_count; ++slot)
+		{
+			int const previous_slot = id_to_slot[particles[slot].id];
+			for(int k = 0; k < no_components; ++k)
+				permuted_values[slot * no_components + k] = channel.values[previous_slot * no_components + k];
+		}
+
+		channel.values.swap(permuted_values);
+	}
 }
 
-void ParticleSystem::add_particle(glm::vec3 const position, glm::vec3 const velocity)
+void ParticleSystem::add_particle(glm::vec3 const position, glm::vec3 const velocity, float const h, float const mass)
 {
-	Particle p(position, velocity);
-	p.add_nutrient(RANDOM(0.2f, 2.5f));
-	particles.push_back(p);
-	model_matrices.push_back(glm::mat4());
-	bin_idx.push_back(0.0f);
-	particle_color.push_back(0.0f);
-	surface_particles.push_back(0u);
+	assert(h > 0.0f);
 
+	// ids are never reused: whoever keeps an id of a dead particle gets -1 from get_slot(), not another particle
+	int const id = Particle::no_particles++;
+
+	// no free slot: grow by half, so buffers are not recreated for every emitted particle
+	if(particle_count == static_cast<GLsizei>(particles.size()))
+		resize_storage(particle_count + std::max(particle_count / 2, 64));
+
+	if(id >= static_cast<int>(id_to_slot.size()))
+	{
+		id_to_slot.resize(id + 1, -1);
+		resize_channels();
+	}
+	id_to_slot[id] = particle_count;
+
+	// a reused slot must not inherit attributes of the dead particle
+	for(auto & channel : channels)
+	{
+		int const index = channel.layout == ChannelLayout::BY_ID ? id : particle_count;
+		std::fill_n(channel.values.begin() + index * channel.no_components, channel.no_components, 0.0f);
+		if(channel.initialize)
+			channel.initialize(id, channel.values.data() + index * channel.no_components);
+	}
+
+	particles[particle_count] = Particle(dimension::pin(position), dimension::pin(velocity), id);
+	particles[particle_count].h = h;
+	particles[particle_count].mass = mass;
 	++particle_count;
+}
+
+int ParticleSystem::clone_particle(int const slot)
+{
+	Particle original = particles[slot];
+	int const original_id = original.id;
+	add_particle(original.position, original.velocity, original.h, original.mass);
+
+	int const copy = particle_count - 1;
+	original.id = particles[copy].id;
+	particles[copy] = original;
+
+	for(auto & channel : channels)
+	{
+		if(channel.layout == ChannelLayout::SCRATCH)
+			continue;
+
+		bool const by_id = channel.layout == ChannelLayout::BY_ID;
+		int const n = channel.no_components;
+		auto const source = channel.values.begin() + (by_id ? original_id : slot) * n;
+		std::copy(source, source + n, channel.values.begin() + (by_id ? original.id : copy) * n);
+	}
+
+	return copy;
+}
+
+void ParticleSystem::blend_channels(int const into, int const from, float const weight)
+{
+	for(auto & channel : channels)
+	{
+		if(channel.layout == ChannelLayout::SCRATCH)
+			continue;
+
+		bool const by_id = channel.layout == ChannelLayout::BY_ID;
+		int const n = channel.no_components;
+		float * const target = channel.values.data() + (by_id ? particles[into].id : into) * n;
+		float const * const source = channel.values.data() + (by_id ? particles[from].id : from) * n;
+		for(int k = 0; k < n; ++k)
+			target[k] += weight * (source[k] - target[k]);
+	}
+}
+
+void ParticleSystem::kill(int const slot)
+{
+	particles[slot].alive = false;
+	#pragma omp atomic
+	++no_killed;
+}
+
+void ParticleSystem::compact()
+{
+	using particle_system::out_of_grid_scope;
+
+	int const no_particles = particle_count;
+
+	// escaped particles are not binned, so nothing would ever interact with them
+	#pragma omp parallel for schedule(static)
+	for(int idx = 0; idx < no_particles; ++idx)
+	{
+		if(particles[idx].alive && out_of_grid_scope(particles[idx].position))
+			kill(idx);
+	}
+
+	if(no_killed == 0)
+		return;
+
+	compacted_particles.resize(particles.size(), make_free_slot());
+
+	// every thread counts live particles of its contiguous range, then writes them behind
+	// live particles of preceding ranges - order is kept
+	#pragma omp parallel default(shared)
+	{
+		int const no_threads = omp_get_num_threads();
+		int const thread = omp_get_thread_num();
+		int const begin = static_cast<int>(static_cast<long long>(no_particles) * thread / no_threads);
+		int const end = static_cast<int>(static_cast<long long>(no_particles) * (thread + 1) / no_threads);
+
+		#pragma omp single
+		thread_offsets.assign(no_threads + 1, 0);
+
+		int no_alive = 0;
+		for(int idx = begin; idx < end; ++idx)
+			no_alive += particles[idx].alive ? 1 : 0;
+		thread_offsets[thread + 1] = no_alive;
+
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for(int t = 0; t < no_threads; ++t)
+				thread_offsets[t + 1] += thread_offsets[t];
+		}
+
+		int slot = thread_offsets[thread];
+		for(int idx = begin; idx < end; ++idx)
+		{
+			if(particles[idx].alive)
+				compacted_particles[slot++] = particles[idx];
+			else
+				id_to_slot[particles[idx].id] = -1;
+		}
+	}
+
+	particle_count = thread_offsets.back();
+	// free slots: just dead, contents do not matter
+	for(int slot = particle_count; slot < static_cast<int>(particles.size()); ++slot)
+		compacted_particles[slot].alive = false;
+
+	particles.swap(compacted_particles);
+	no_killed = 0;
+}
+
+void ParticleSystem::save_state(ParticleSystemState & state) const
+{
+	state.particles = particles;
+	state.particle_count = particle_count;
+	state.channel_values.resize(channels.size());
+	for(int handle = 0; handle < static_cast<int>(channels.size()); ++handle)
+		state.channel_values[handle] = channels[handle].values;
+	state.id_to_slot = id_to_slot;
+}
+
+void ParticleSystem::restore_state(ParticleSystemState const & state)
+{
+	if(state.particles.size() != particles.size())
+		resize_storage(static_cast<int>(state.particles.size()));
+
+	particles = state.particles;
+	particle_count = state.particle_count;
+	// ids handed out after the save stay retired (Particle::no_particles does not go back), so nobody
+	// holding one of them gets a particle of the restored state
+	id_to_slot = state.id_to_slot;
+	id_to_slot.resize(Particle::no_particles, -1);
+	// the state is saved before the sort step, so it can hold particles killed after the last compact()
+	// (e.g. merged by Simulation::adapt_resolution()); the next compact() must still remove them
+	no_killed = 0;
+	for(int slot = 0; slot < particle_count; ++slot)
+		no_killed += particles[slot].alive ? 0 : 1;
+
+	for(int handle = 0; handle < static_cast<int>(channels.size()); ++handle)
+	{
+		if(handle < static_cast<int>(state.channel_values.size()))
+			channels[handle].values = state.channel_values[handle];
+		else
+			std::fill(channels[handle].values.begin(), channels[handle].values.end(), 0.0f);
+	}
+	resize_channels();
+}
+
+void ParticleSystem::resize_storage(int const capacity)
+{
+	particles.resize(capacity, make_free_slot());
+	model_matrices.resize(capacity);
+	bin_idx.resize(capacity);
+	particle_color.resize(capacity);
+	surface_particles.resize(capacity);
+	resize_channels();
 
 	// resize buffers
 	reset_buffers();
-	//setup_buffers();
 }
 
 void ParticleSystem::move_particles_around(float dt)
@@ -273,13 +586,16 @@ void ParticleSystem::move_particles_around(float dt)
 	double v0 = 10.0;
 	float a = -0.008f;
 	static float t = 0.0f;
+	static uint64_t call_count = 0u;
 	t += dt*200.f;
+	++call_count;
 	//float x = (a*sqrt(2)*cos(t)) / (pow(sin(t), 2) + 1);
 	//float y = (a*sqrt(2)*cos(t)*sin(t)) / (pow(sin(t), 2) + 1);
 
-	for(auto& p : particles)
+	for(int idx = 0; idx < particle_count; ++idx)
 	{
-		float r = RANDOM(0.002f, 0.012f);
+		auto & p = particles[idx];
+		float r = rng::uniform(rng::PARTICLE_JITTER, (call_count << 32) | static_cast<uint64_t>(p.id), 0.002f, 0.012f);
 		//float tt = t*RANDOM(0.7f, 1.2f);
 		float x = r*cos(t);
 		float y = r*sin(t);
@@ -291,20 +607,39 @@ void ParticleSystem::move_particles_around(float dt)
 
 void ParticleSystem::insert_sort_particles_by_indices()
 {
-	using particle_system::get_cell_index;
+	using particle_system::get_sort_key;
 
+	compact();
+
+	// insertion sort is stable and fast for almost sorted data (particles move little per step)
 	for(int i = 1; i < particle_count; i++)
 	{
 		auto const particle_i = particles[i];
-		auto const particle_i_idx = get_cell_index(particle_i.position);
+		auto const particle_i_key = get_sort_key(particle_i);
 		int j;
 
-		for(j = i - 1; j >= 0 && get_cell_index(particles[j].position) > particle_i_idx; j--)
+		for(j = i - 1; j >= 0 && get_sort_key(particles[j]) > particle_i_key; j--)
 			particles[j + 1] = particles[j];
 
 		particles[j + 1] = particle_i;
 	}
 
+	permute_sorted_channels();
+
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < particle_count; ++slot)
+		id_to_slot[particles[slot].id] = slot;
+
+	// GPU buffers shrink lazily: only when mostly unused, to half of the capacity that fits
+	// (here and not in compact(), SORTED channels are in slot order only after the permutation)
+	int const capacity = static_cast<int>(particles.size());
+	if(particle_count < capacity / 4 && capacity > 256)
+	{
+		resize_storage(std::max(2 * particle_count, 64));
+		std::vector<Particle>().swap(compacted_particles);
+	}
+
+
 	// http://codereview.stackexchange.com/questions/110793/insertion-sort-in-c
 	//for(auto it = begin(particles) + 1; it != end(particles); ++it)
 	//{
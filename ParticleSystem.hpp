@@ -3,11 +3,14 @@
 // http://www.gamasutra.com/view/feature/131565/building_an_advanced_particle_.php
 
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
 #include "SphereModel.hpp"
 #include "Particle.hpp"
+#include "AttributeChannel.hpp"
+#include "DerivedFields.hpp"
 #include "Paintable.hpp"
 
 
@@ -18,20 +21,41 @@ namespace particle_system
 	glm::ivec3 get_grid_coords(glm::vec3 const v);
 	glm::vec3 get_grid_coords_in_real_system(glm::vec3 const v);
 	bool out_of_grid_scope(const glm::vec3 v);
+	// along periodic axes (c::periodic_x/y/z) brings a point back into the grid; other axes untouched
+	glm::vec3 wrap_position(glm::vec3 v);
+	// shortest periodic image of a distance vector (rVec unchanged if no axis is periodic)
+	glm::vec3 minimum_image(glm::vec3 rVec);
+	int64_t get_sort_key(Particle const & p);
 	inline uint64_t get_z_index(glm::ivec3 const v);
 	inline uint64_t mortonEncode_magicbits(unsigned int x, unsigned int y, unsigned int z);
 	inline uint64_t splitBy3(unsigned int a);
 }
 
+/**
+ * Copy of everything ParticleSystem needs to continue from the end of a step (see ParticleSystem::save_state()).
+ * GL buffers are not part of it, they are refilled every step.
+ */
+struct ParticleSystemState
+{
+	std::vector<Particle> particles;
+	GLsizei particle_count;
+	std::vector<std::vector<float> > channel_values;// [channel handle]
+	std::vector<int> id_to_slot;
+};
+
 /**
  * Stores and sorts (according to bin [cell] index) particles.
  * Does NOT place particles into bins (see Simulation::bin_particles_in_grid()).
+ * Anything not needed by the SPH passes lives in AttributeChannels (see register_channel()).
  */
 class ParticleSystem : public Paintable
 {
 public:
 	// http://stackoverflow.com/questions/20091046/what-should-a-c-getter-return
 	friend class Simulation;// jedynie do macania 'std::array<> particles'
+	friend class Emitters;// outflow zones kill particles in place
+	friend class DiffusionLattice;// splats positions and densities
+	friend class ImplicitViscosity;// reads densities and velocities, adds to accelerations
 
 	ParticleSystem();
 
@@ -40,23 +64,102 @@ public:
 
 	void reset_buffers();
 	void move_particles_around(float dt);
-	void update_buffers();
+	// model matrices always; bin indices, colors and surface flags only if in fields (DerivedField bits)
+	void update_buffers(unsigned const fields);
 	std::unique_ptr<glm::vec4[]> get_position_color_field_data();
 
-	GLfloat compute_particle_color(Particle const & p);
-	void add_particle(glm::vec3 const position, glm::vec3 const velocity);
+	GLfloat compute_particle_color(int const slot) const;
+
+	/**
+	 * Allocates a channel of no_components floats per particle (zeroed, or set by initialize
+	 * for particles added later, see AttributeChannel); registering
+	 * an existing name returns the existing channel. SORTED channels cost a gather per sort step,
+	 * the other layouts cost nothing there.
+	 * @return	handle for get_channel()
+	 */
+	int register_channel(std::string const & name, int const no_components, ChannelLayout const layout, AttributeChannel::Initializer initialize = nullptr);
+	// handle of a registered channel, -1 if there is none
+	int find_channel(std::string const & name) const;
+	// channel values; pointer is valid until the next add_particle() or sort step
+	float * get_channel(int const handle) { return channels[handle].values.data(); }
+	float const * get_channel(int const handle) const { return channels[handle].values.data(); }
+
+	/**
+	 * Takes the first free slot behind live particles (a dead one, if any);
+	 * storage and GL buffers grow only when there is none left.
+	 * h	support radius, > 0 (neighbour searches reach as far as the largest one needs, see Grid::get_reach())
+	 */
+	void add_particle(glm::vec3 const position, glm::vec3 const velocity, float const h = c::H, float const mass = c::particleMass);
+
+	/**
+	 * Slot of a live particle with Particle::id == id, -1 if there is none (also once it died: ids are not reused); O(1).
+	 * Valid after the sort step and add_particle(); anything kept per id (probes, trajectories,
+	 * cold attributes) can stay where it is while the sort moves Particle structs around.
+	 */
+	int get_slot(int const id) const { return id >= 0 && id < static_cast<int>(id_to_slot.size()) ? id_to_slot[id] : -1; }
+
+	/**
+	 * Adds a copy of the particle at slot with a new id (particle splitting).
+	 * SORTED and BY_ID channel values are copied, SCRATCH ones start at 0.
+	 * @return	slot of the copy; storage may grow, so references to particles are invalidated
+	 */
+	int clone_particle(int const slot);
+	// SORTED and BY_ID values of slot into become (1 - weight) * into + weight * from (particle merging)
+	void blend_channels(int const into, int const from, float const weight);
+
+	/**
+	 * Marks a live particle dead (outflow, user removal). It keeps its slot until
+	 * the next compact(), which is a part of the sort step. Safe to call from parallel loops.
+	 */
+	void kill(int const slot);
+
+	/**
+	 * Parallel stable compaction: live particles keep their order and move to [0, particle_count),
+	 * dead slots become free slots for add_particle(). Also kills particles which escaped the grid.
+	 */
+	void compact();
 
 	/**
 	 * Sorts particles by a cell (bin) index. cell is an elementary part
 	 * of Grid. Thanks to sorting the Grid can easily store an information about neighbours.
+	 * Compacts storage first, so only live particles, all inside the grid, are sorted.
+	 * Afterwards permutes SORTED channels, rebuilds id to slot permutation (see get_slot())
+	 * and shrinks storage and GL buffers when less than a quarter of them is used.
 	 */
 	void insert_sort_particles_by_indices();
 
+	// copies particles, channels and id bookkeeping into state; keeps its allocations, so a reused state costs no allocation
+	void save_state(ParticleSystemState & state) const;
+	/**
+	 * Continues from a saved state; storage and GL buffers take its capacity.
+	 * Channels registered after the save are zeroed; particles the state holds dead are removed by the next compact().
+	 */
+	void restore_state(ParticleSystemState const & state);
+
 	GLsizei const bin_count = c::C;// == c::C
-	GLsizei particle_count = c::N;// == c::N
+	GLsizei particle_count = c::N;// live particles: [0, particle_count) of particles; rest are free slots
+
+	// channels every run needs (registered by the constructor)
+	int color_field_gradient_magnitude_channel;// SCRATCH, written by Simulation::compute_forces()
+	int color_channel;// first component is the particle color (see compute_particle_color()); -1 - none
 
 private:
+	// resizes particles and per-instance render data to capacity slots (new ones free) and recreates GL buffers
+	void resize_storage(int const capacity);
+
 	std::vector<Particle> particles;// wszystkie posortowane (wzgledem indeksu w tablicy grid) Particle
+	std::vector<Particle> compacted_particles;// compact() scatters here, then swaps; kept to avoid reallocation
+	std::vector<int> thread_offsets;// compact(): first output slot of every thread's range
+	int no_killed;// since last compact()
+	std::vector<int> id_to_slot;// [Particle::id] - slot in particles, -1 for ids of dead particles; one entry per id ever handed out
+
+	// gathers SORTED channels into the new slot order; needs id_to_slot from before the sort
+	void permute_sorted_channels();
+	// resizes channels to capacity slots / id_to_slot.size() ids
+	void resize_channels();
+
+	std::vector<AttributeChannel> channels;
+	std::vector<float> permuted_values;// permute_sorted_channels() scratch
 
 	// Geometry, instance offset array
 	GLfloat const static point_vertices[3];
@@ -0,0 +1,25 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ParticleSystem.hpp"
+#include "PositionCache.hpp"
+
+
+void PositionCache::build(std::vector<Particle> const & particles, int const no_particles)
+{
+	using particle_system::get_cell_index;
+
+	entries.resize(no_particles);
+	glm::vec3 const step = get_step();
+
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		glm::vec3 const position = particles[slot].position;
+		glm::vec3 const offset = (position - get_cell_min(get_cell_index(position))) / step;
+
+		// rounded, so the error per axis is at most half a step (plus float rounding of the offset)
+		auto const quantise = [](float const value) { return static_cast<uint16_t>(std::min(std::max(value + 0.5f, 0.0f), 65535.0f)); };
+		entries[slot] = { quantise(offset.x), quantise(offset.y), quantise(offset.z) };
+	}
+}
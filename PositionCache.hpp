@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+struct Particle;
+
+/**
+ * Particle positions packed to 16 bits per axis, relative to the min corner of their Grid cell
+ * (6 bytes instead of a whole Particle), for the cull of neighbour candidates: the cells searched
+ * around a particle hold several times more candidates than neighbours, and most of them are rejected
+ * by this gather alone. Candidates closer than the search radius + get_margin() are tested again with exact positions,
+ * so the passes give the same results with or without the cache.
+ * Indexed by slot; valid from the sort step until particles move (Simulation::advance()).
+ */
+class PositionCache
+{
+public:
+	struct Entry
+	{
+		uint16_t x, y, z;
+	};
+
+	// encodes [0, no_particles); particles must be inside the grid
+	void build(std::vector<Particle> const & particles, int const no_particles);
+
+	// min corner of a Grid cell (see particle_system::get_cell_index())
+	static glm::vec3 get_cell_min(int const cell_index)
+	{
+		int const x = cell_index % c::K, y = (cell_index / c::K) % c::L, z = cell_index / (c::K * c::L);
+		return glm::vec3(static_cast<float>(x)*c::dx + c::xmin, static_cast<float>(y)*c::dy + c::ymin, static_cast<float>(z)*c::dz + c::zmin);
+	}
+
+	// cell_min - get_cell_min() of the cell the particle at slot is binned in
+	glm::vec3 decode(int const slot, glm::vec3 const cell_min) const
+	{
+		Entry const entry = entries[slot];
+		glm::vec3 const step = get_step();
+		return cell_min + glm::vec3(entry.x * step.x, entry.y * step.y, entry.z * step.z);
+	}
+
+	// bound of |decoded - exact| distance error of a pair, one particle exact and one decoded
+	static float get_margin() { return glm::length(glm::vec3(c::dx, c::dy, c::dz)) / 65535.0f; }
+
+	std::vector<Entry> const & get_entries() const { return entries; }
+
+private:
+	static glm::vec3 get_step() { return glm::vec3(c::dx, c::dy, c::dz) / 65535.0f; }
+
+	std::vector<Entry> entries;
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "MathTier.hpp"
+
+/**
+ * Precision policies of the neighbour passes (Simulation::compute_density_with<Precision>(),
+ * compute_forces_with<Precision>()), chosen by c::precision.
+ * Storage (Particle, channels) is float either way; a policy sets the types the passes compute in:
+ * Scalar	density, color field laplacian sums over neighbours
+ * Vector	pressure, viscosity and color field gradient sums
+ * Real, PairVector	distance and rVec of a pair, kernel values and pair terms
+ * Math	math tier of the pair terms (see math_tier::)
+ * Sums of many small terms (dense or finely resolved regions, large h / spacing ratios) lose low bits
+ * in float; double accumulators keep them at the cost of conversions in the inner loop.
+ * Left out: positions are stored in float relative to the global origin, so a particle far from it sits
+ * on a coarser lattice (ulp of its coordinates) whatever the policy. rVec of a close pair, the difference
+ * of two such floats, is exact already; only double (or cell-relative) Particle::position through the
+ * integrators, collisions and adaptivity would keep that, not the passes. Kernel normalisations
+ * (dimension::Traits) and boundary particle terms stay float in all policies.
+ */
+namespace precision
+{
+	struct Single
+	{
+		static char const * name() { return "single"; }
+		using Scalar = float;
+		using Vector = glm::vec3;
+		using Real = float;
+		using PairVector = glm::vec3;
+		using Math = math_tier::Current;
+	};
+
+	// float storage and pair terms, double accumulation
+	struct Mixed
+	{
+		static char const * name() { return "mixed"; }
+		using Scalar = double;
+		using Vector = glm::dvec3;
+		using Real = float;
+		using PairVector = glm::vec3;
+		using Math = math_tier::Current;
+	};
+
+	// float storage, double pair terms and accumulation with IEEE sqrt and pow (c::math_tier is ignored); the reference of the other two
+	struct Double
+	{
+		static char const * name() { return "double"; }
+		using Scalar = double;
+		using Vector = glm::dvec3;
+		using Real = double;
+		using PairVector = glm::dvec3;
+		using Math = math_tier::Exact;
+	};
+}
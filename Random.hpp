@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+
+#include "constants.hpp"
+
+/**
+ * Counter-based random numbers.
+ * A value is a pure function of (seed, stream, counter), not of call order,
+ * so it is the same no matter which thread asks or how often others asked before.
+ * counter is usually Particle::id (per-particle random numbers),
+ * stream says what the number is used for.
+ */
+namespace rng
+{
+	enum Stream : uint64_t
+	{
+		PARTICLE_POSITION_X = 1,
+		PARTICLE_POSITION_Y,
+		PARTICLE_POSITION_Z,
+		PARTICLE_SPECIES,// counter: id | species << 32
+		PARTICLE_JITTER,
+		EMITTER_OFFSET,
+		PARTICLE_SPLIT_Z,// counter: id | iteration << 32
+		PARTICLE_SPLIT_PHI
+	};
+
+	// splitmix64 finalizer: http://xoshiro.di.unimi.it/splitmix64.c
+	inline uint64_t mix(uint64_t x)
+	{
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	// c::random_seed in deterministic mode, otherwise different every run
+	inline uint64_t session_seed()
+	{
+		static uint64_t const seed = c::deterministic ? c::random_seed : static_cast<uint64_t>(time(nullptr));
+		return seed;
+	}
+
+	inline uint64_t hash(uint64_t stream, uint64_t counter)
+	{
+		return mix(mix(session_seed() + stream * 0x9e3779b97f4a7c15ull) ^ counter);
+	}
+
+	// uniform in [min, max)
+	inline float uniform(uint64_t stream, uint64_t counter, float min, float max)
+	{
+		float const unit = static_cast<float>(hash(stream, counter) >> 40) * (1.0f / 16777216.0f);// 24 bits of mantissa
+		return min + (max - min) * unit;
+	}
+}
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+#include <omp.h>
+
+#include "NeighbourList.hpp"
+#include "ParticleSystem.hpp"
+#include "Random.hpp"
+#include "ReactionDiffusion.hpp"
+
+
+ReactionDiffusion::ReactionDiffusion() : concentration_channel(-1), rate_channel(-1)
+{
+}
+
+int ReactionDiffusion::add_species(Species const & new_species)
+{
+	// channel layout is fixed once registered
+	assert(concentration_channel == -1);
+	assert(get_no_species() < c::max_species);
+
+	species.push_back(new_species);
+	return get_no_species() - 1;
+}
+
+void ReactionDiffusion::add_reaction(Reaction reaction)
+{
+	reactions.push_back(std::move(reaction));
+}
+
+void ReactionDiffusion::attach(ParticleSystem & particle_system)
+{
+	int const no_species = get_no_species();
+	if(no_species == 0)
+		return;
+
+	// species k of particle id: counter id | k << 32, so species 0 draws the same numbers as the single nutrient did
+	auto const initial_species = species;
+	concentration_channel = particle_system.register_channel("species", no_species, ChannelLayout::SORTED,
+		[initial_species](int const id, float * values)
+	{
+		for(int k = 0; k < static_cast<int>(initial_species.size()); ++k)
+			values[k] = rng::uniform(rng::PARTICLE_SPECIES, static_cast<uint64_t>(id) | static_cast<uint64_t>(k) << 32,
+				initial_species[k].initial_min, initial_species[k].initial_max);
+	});
+	rate_channel = particle_system.register_channel("species_rate", no_species, ChannelLayout::SCRATCH);
+}
+
+void ReactionDiffusion::compute_rates(float const * concentrations, float const * laplacians, float * rates) const
+{
+	int const no_species = get_no_species();
+	for(int k = 0; k < no_species; ++k)
+		rates[k] = laplacians[k] * species[k].diffusion - species[k].consumption_rate;
+
+	for(auto const & reaction : reactions)
+		reaction(concentrations, rates);
+}
+
+void ReactionDiffusion::step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt)
+{
+	if(concentration_channel == -1)
+		return;
+
+	if(c::diffusion_solver == c::IMPLICIT_JACOBI)
+	{
+		implicit_step(particle_system, neighbours, weights, dt);
+		return;
+	}
+
+	int const no_substeps = count_substeps(neighbours, weights, dt);
+	for(int substep = 0; substep < no_substeps; ++substep)
+		explicit_step(particle_system, neighbours, weights, dt / no_substeps);
+}
+
+void ReactionDiffusion::explicit_step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt) const
+{
+	int const no_species = get_no_species();
+	int const no_particles = neighbours.get_no_particles();
+	auto const & offsets = neighbours.get_offsets();
+	auto const & pairs = neighbours.get_neighbours();
+	float * const concentrations = particle_system.get_channel(concentration_channel);
+	float * const rates = particle_system.get_channel(rate_channel);
+
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		float const * const concentration_i = concentrations + slot * no_species;
+		float laplacians[c::max_species] = {};
+
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			float const * const concentration_j = concentrations + pairs[n].slot * no_species;
+			for(int k = 0; k < no_species; ++k)
+				laplacians[k] += (concentration_j[k] - concentration_i[k])*weights[n];
+		}
+
+		compute_rates(concentration_i, laplacians, rates + slot * no_species);
+	}
+
+	// all rates first: neighbours read old concentrations; species of consecutive particles are consecutive
+	int const no_values = no_particles * no_species;
+	#pragma omp parallel for schedule(static)
+	for(int idx = 0; idx < no_values; ++idx)
+		concentrations[idx] = concentrations[idx] + rates[idx] * dt * c::reaction_time_scale;
+}
+
+void ReactionDiffusion::implicit_step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt)
+{
+	int const no_species = get_no_species();
+	int const no_particles = neighbours.get_no_particles();
+	auto const & offsets = neighbours.get_offsets();
+	auto const & pairs = neighbours.get_neighbours();
+	float * const concentrations = particle_system.get_channel(concentration_channel);
+	float * const right_hand_sides = particle_system.get_channel(rate_channel);
+	float const step = dt * c::reaction_time_scale;
+
+	float diffusion_steps[c::max_species];
+	for(int k = 0; k < no_species; ++k)
+		diffusion_steps[k] = step * species[k].diffusion;
+
+	// (1 - step * D * L) c_new = c + step * (reactions - consumption)
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		float const no_laplacians[c::max_species] = {};
+		float const * const concentration_i = concentrations + slot * no_species;
+		float * const right_hand_side = right_hand_sides + slot * no_species;
+
+		compute_rates(concentration_i, no_laplacians, right_hand_side);
+		for(int k = 0; k < no_species; ++k)
+			right_hand_side[k] = concentration_i[k] + right_hand_side[k] * step;
+	}
+
+	// Jacobi: diagonal 1 + step * D * sum_j w_ij always dominates, so the sweeps converge; starts from current concentrations
+	iterate.resize(no_particles * no_species);
+	float * current = concentrations;
+	float * next = iterate.data();
+	for(int iteration = 0; iteration < c::diffusion_jacobi_iterations; ++iteration)
+	{
+		#pragma omp parallel for schedule(static)
+		for(int slot = 0; slot < no_particles; ++slot)
+		{
+			float sums[c::max_species] = {};
+			float weight_sum = 0.0f;
+
+			for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+			{
+				float const * const concentration_j = current + pairs[n].slot * no_species;
+				weight_sum += weights[n];
+				for(int k = 0; k < no_species; ++k)
+					sums[k] += concentration_j[k] * weights[n];
+			}
+
+			for(int k = 0; k < no_species; ++k)
+				next[slot * no_species + k] = (right_hand_sides[slot * no_species + k] + diffusion_steps[k] * sums[k]) / (1.0f + diffusion_steps[k] * weight_sum);
+		}
+		std::swap(current, next);
+	}
+
+	if(current != concentrations)
+		std::copy(current, current + no_particles * no_species, concentrations);
+}
+
+void ReactionDiffusion::step_on_lattice(ParticleSystem & particle_system, std::array<int, c::C + 1> const & particle_offsets, float const dt)
+{
+	if(concentration_channel == -1)
+		return;
+
+	int const no_species = get_no_species();
+	int const no_particles = particle_system.particle_count;
+	float * const concentrations = particle_system.get_channel(concentration_channel);
+	float * const increments = particle_system.get_channel(rate_channel);
+
+	float diffusion[c::max_species];
+	for(int k = 0; k < no_species; ++k)
+		diffusion[k] = species[k].diffusion;
+
+	lattice.diffuse(particle_system, particle_offsets, concentrations, no_species, diffusion, dt * c::reaction_time_scale, increments);
+
+	// reactions from concentrations before diffusion, like in the particle modes
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		float const no_laplacians[c::max_species] = {};
+		float rates[c::max_species];
+		float * const concentration_i = concentrations + slot * no_species;
+
+		compute_rates(concentration_i, no_laplacians, rates);
+		for(int k = 0; k < no_species; ++k)
+			concentration_i[k] = concentration_i[k] + increments[slot * no_species + k] + rates[k] * dt * c::reaction_time_scale;
+	}
+}
+
+int ReactionDiffusion::count_substeps(NeighbourList const & neighbours, std::vector<float> const & weights, float const dt) const
+{
+	int const no_particles = neighbours.get_no_particles();
+	auto const & offsets = neighbours.get_offsets();
+
+	float max_diffusion = 0.0f;
+	for(auto const & s : species)
+		max_diffusion = std::max(max_diffusion, s.diffusion);
+
+	// no max reduction in OpenMP 2.0: one maximum per thread
+	std::vector<float> thread_max_weight_sum(omp_get_max_threads(), 0.0f);
+	#pragma omp parallel
+	{
+		float max_weight_sum = 0.0f;
+		#pragma omp for schedule(static)
+		for(int slot = 0; slot < no_particles; ++slot)
+		{
+			float weight_sum = 0.0f;
+			for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+				weight_sum += weights[n];
+			max_weight_sum = std::max(max_weight_sum, weight_sum);
+		}
+		thread_max_weight_sum[omp_get_thread_num()] = max_weight_sum;
+	}
+	float const max_weight_sum = *std::max_element(thread_max_weight_sum.begin(), thread_max_weight_sum.end());
+
+	float const stiffness = dt * c::reaction_time_scale * max_diffusion * max_weight_sum;
+	return std::max(1, static_cast<int>(std::ceil(stiffness / c::diffusion_stability_limit)));
+}
+
+int ReactionDiffusion::find_species(std::string const & name) const
+{
+	for(int k = 0; k < get_no_species(); ++k)
+		if(species[k].name == name)
+			return k;
+	return -1;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "constants.hpp"
+#include "DiffusionLattice.hpp"
+
+class ParticleSystem;
+class NeighbourList;
+
+/**
+ * Substance dissolved in the fluid and carried by particles.
+ * name	unique, see ReactionDiffusion::find_species()
+ * diffusion	coefficient of the SPH Laplacian term
+ * consumption_rate	constant sink per unit time, the same for every particle
+ * initial_min, initial_max	concentration of an emitted particle is uniform in [initial_min, initial_max)
+ */
+struct Species
+{
+	std::string name;
+	float diffusion;
+	float consumption_rate;
+	float initial_min;
+	float initial_max;
+};
+
+/**
+ * Diffusion and reactions of several species at once.
+ * Concentrations of one particle are adjacent in a single SORTED channel ("species"),
+ * so a pass over the pairs of neighbours reads a pair weight once and updates every species
+ * in a short inner loop over a fixed size array; the pass costs little more for K species than for one.
+ * Pairs come from the NeighbourList of the step, so sub-steps and solver sweeps never search the grid.
+ * Reactions are local: they see the concentrations of one particle and add to its rates of change.
+ *
+ * Usage: add_species(...), add_reaction(...), then attach(particle_system) once.
+ */
+class ReactionDiffusion
+{
+public:
+	// rates[k] += d concentrations[k] / dt, k - index returned by add_species()
+	using Reaction = std::function<void(float const * concentrations, float * rates)>;
+
+	ReactionDiffusion();
+
+	// @return	index of the species (component of the "species" channel); at most c::max_species
+	int add_species(Species const & new_species);
+	void add_reaction(Reaction reaction);
+
+	// registers the "species" (SORTED) and "species_rate" (SCRATCH) channels; species are fixed afterwards
+	void attach(ParticleSystem & particle_system);
+
+	/**
+	 * Advances concentrations by dt * c::reaction_time_scale.
+	 * @param weights	one per pair of neighbours, indexed like neighbours.get_neighbours():
+	 	laplacian of a species at particle i is sum_j weights[ij] * (concentration_j - concentration_i)
+	 * c::diffusion_solver:
+	 * EXPLICIT_SUBCYCLED	forward Euler in as few equal sub-steps as the stability bound allows
+	 	(sub-step * diffusion * max_i sum_j weights[ij] <= c::diffusion_stability_limit)
+	 * IMPLICIT_JACOBI	backward Euler for diffusion (reactions explicit), c::diffusion_jacobi_iterations
+	 	sweeps; stable for any dt, cost does not grow with diffusion
+	 * (LATTICE uses step_on_lattice() instead)
+	 */
+	void step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt);
+
+	/**
+	 * c::diffusion_solver == LATTICE: diffusion on a regular lattice (see DiffusionLattice), O(particles + nodes)
+	 * instead of O(pairs); reactions and consumption stay per particle. Needs no NeighbourList.
+	 * @param particle_offsets	exclusive prefix sum of particles per Grid cell
+	 */
+	void step_on_lattice(ParticleSystem & particle_system, std::array<int, c::C + 1> const & particle_offsets, float const dt);
+
+	int get_no_species() const { return static_cast<int>(species.size()); }
+	// -1 if there is none
+	int find_species(std::string const & name) const;
+	// channel handles, -1 before attach()
+	int get_concentration_channel() const { return concentration_channel; }
+	int get_rate_channel() const { return rate_channel; }
+
+private:
+	// rates of change of one particle: diffusion * laplacian - consumption_rate + reactions
+	void compute_rates(float const * concentrations, float const * laplacians, float * rates) const;
+	// one forward Euler step of length dt (unscaled) from current concentrations
+	void explicit_step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt) const;
+	void implicit_step(ParticleSystem & particle_system, NeighbourList const & neighbours, std::vector<float> const & weights, float const dt);
+	// number of explicit sub-steps needed for stability
+	int count_substeps(NeighbourList const & neighbours, std::vector<float> const & weights, float const dt) const;
+
+	std::vector<Species> species;
+	std::vector<Reaction> reactions;
+	int concentration_channel;// [slot * no_species + k]
+	int rate_channel;// [slot * no_species + k]; step_on_lattice(): diffusion increments
+	std::vector<float> iterate;// implicit_step(): second Jacobi buffer
+	DiffusionLattice lattice;
+};
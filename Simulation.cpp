@@ -1,10 +1,69 @@
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Dimension.hpp"
+#include "Kernels.hpp"
+#include "Random.hpp"
 #include "Simulation.hpp"
 
 
-Simulation::Simulation() : particle_count(0), mechanical_energy(0.0f), stats_file("./../plot/wydajnosc/perf(t) " + std::to_string(c::K) + ".txt")
+Simulation::Simulation() : integrator(c::integrator), time_step(c::dt), particle_count(0), iteration_count(0u), sim_time(0.0f), mechanical_energy(0.0f), stats_file("./../plot/wydajnosc/perf(t) " + std::to_string(c::K) + ".txt"),
+	snapshots(c::no_snapshots), newest_snapshot(c::no_snapshots - 1), no_snapshots(0), no_rollbacks(0), healthy_steps(0u), gave_up(false), wanted_fields(0u), staggered_integrator(false)
 {
 	start_time = std::chrono::high_resolution_clock::now();
 	emitters.set_particle_system(particle_system);
+
+	reaction_diffusion.add_species({ "nutrient", c::nutrient_diffusion, c::nutrient_consumption_rate, 0.2f, 2.5f });// species 0
+	// e.g. nutrient turned into waste, which diffuses slower:
+	//int const nutrient = 0;
+	//int const waste = reaction_diffusion.add_species({ "waste", 0.05f, 0.0f, 0.0f, 0.0f });
+	//reaction_diffusion.add_reaction([nutrient, waste](float const * concentrations, float * rates)
+	//{
+	//	float const uptake = 0.5f * concentrations[nutrient];
+	//	rates[nutrient] -= uptake;
+	//	rates[waste] += uptake;
+	//});
+	reaction_diffusion.attach(particle_system);
+	particle_system.color_channel = reaction_diffusion.get_concentration_channel();// colored by nutrient (species 0)
+
+	// consumers inside the solver; the renderer and tools register their own (see Application)
+	if(c::surfaceTension != 0.0f)
+		derived_fields.register_interest(COLOR_FIELD);
+	if(c::adaptive_resolution)
+		derived_fields.register_interest(COLOR_FIELD, c::adaptivity_interval);
+
+	// no container walls across periodic axes (nor along z in 2D)
+	glm::vec3 container_min = bounding_box.top_right_front_corner, container_max = bounding_box.bottom_left_back_corner;
+	if(c::periodic_x) { container_min.x = c::xmin - 1.0f; container_max.x = c::xmax + 1.0f; }
+	if(c::periodic_y) { container_min.y = c::ymin - 1.0f; container_max.y = c::ymax + 1.0f; }
+	if(c::periodic_z || c::dimensions == 2) { container_min.z = c::zmin - 1.0f; container_max.z = c::zmax + 1.0f; }
+	boundary.set_container_box(container_min, container_max);
+	//boundary.add_sphere_obstacle(glm::vec3(0.1f, c::ymin + 0.05f, 0.0f), 0.04f);
+	//boundary.add_obj_obstacle("models/obstacle.obj", glm::vec3(0.0f, c::ymin, 0.0f), 0.05f);
+	boundary.finalize();
+	boundary_particles.sample_from_sdf(boundary);
+	grid.find_near_wall_cells(boundary);
+
+	// e.g. piston pushing along x (wave tank):
+	//MovingBoundary piston(glm::vec3(-0.01f, -0.1f, -0.2f), glm::vec3(0.01f, 0.1f, 0.2f), [](float time)
+	//{
+	//	return glm::translate(glm::mat4(), glm::vec3(-0.15f + 0.05f * sin(2.0f * c::PIf * 0.5f * time), 0.0f, 0.0f));
+	//});
+	//piston.get_shape().add_box_obstacle(glm::vec3(-0.005f, -0.1f, -0.2f), glm::vec3(0.005f, 0.1f, 0.2f));
+	//piston.get_shape().finalize();
+	//moving_boundaries.push_back(std::move(piston));
+
+	if(c::deterministic)
+		state_hash_log = std::make_unique<StateHashLog>(c::state_hash_log_path, c::golden_state_hash_path);
+	// steady inflow/outflow (channel): emitter which never expires, particles killed at the far end
+	//Emitter inflow(glm::vec3(c::xmin + c::H*2.0f, 0.0f, 0.0f), glm::vec3(0.5f, 0.0f, 0.0f));
+	//inflow.ttl = FLT_MAX;
+	//emitters.add_emitter(inflow);
+	//emitters.add_outflow(Outflow{ glm::vec3(c::xmax - c::H*2.0f, c::ymin, c::zmin), glm::vec3(c::xmax, c::ymax, c::zmax) });
 	//emitters.add_emitter(Emitter(glm::vec3(-0.1f, -0.2f, 0.0f)));
 	//emitters.add_emitter(Emitter(glm::vec3(0.1f, c::ymin + c::H*2.0f, 0.0f), glm::vec3(-3.5f, 0.3f, 0.0f)));
 	//emitters.add_emitter(Emitter(glm::vec3(c::xmax - c::H*2.0f, -c::H, c::zmax - c::H*2.0f), glm::vec3(-3.5f, 0.3f, 0.0f)));
@@ -26,168 +85,291 @@ Simulation::~Simulation()
 
 void Simulation::run(float dt)
 {
+	if(gave_up)
+		return;
+	if(no_snapshots == 0 || (iteration_count % c::snapshot_interval == 0u && snapshots[newest_snapshot].iteration_count != iteration_count))
+		save_snapshot();
+	wanted_fields = derived_fields.get_wanted(iteration_count + 1u);
+
 	emit_particles();
+	update_moving_boundaries(time_step);
 
 	grid.clear_grid();
 	particle_system.insert_sort_particles_by_indices();
 	bin_particles_in_grid();
+	if(c::position_cache)
+		position_cache.build(particle_system.particles, particle_system.particle_count);
 
 	compute_density();
-
-	//for(int i = 0; i < 5; ++i)
-		compute_nutrient_concentration();
+	compute_reaction_diffusion();
 
 	compute_forces();
-	resolve_collisions();
-	advance();
+	if(c::viscosity_solver == c::IMPLICIT_VISCOSITY)
+		compute_implicit_viscosity();
+	if(wanted_fields & VORTICITY)
+		compute_vorticity();
+	advance();// + collisions
+	if(check_health())
+		adapt_resolution();
 
 	// tutaj bo Painter::paint() jest const
 	// do wizualizacji:
 	// za pomoca siatki generowanej przez MC
-	//mesh.generate_mesh(grid.grid);
+	// (both need SURFACE_FLAGS registered in derived_fields, see get_surface_slots())
+	//mesh.generate_mesh(grid.grid, particle_system.particles, surface_slots);
 	// przy pomocy ray castingu na distance field
-	//distance_field.generate_field_from_surface_particles(extract_surface_particles());
+	//distance_field.generate_field_from_surface_particles(particle_system.particles, surface_slots);
 	// wizualizacja poszczegolnych czasteczek
-	particle_system.update_buffers();
-}
-
-void Simulation::bin_particles_in_grid()
-{
-	using particle_system::get_cell_index;
-	using particle_system::out_of_grid_scope;
-	using particle_system::get_grid_coords;
-	using particle_system::get_z_index;
+	particle_system.update_buffers(wanted_fields);
 
-	auto & particles = particle_system.particles;
-	auto & grid = this->grid.grid;
+	// iteration_count is advanced in advance()
+	if(state_hash_log && iteration_count % c::state_hash_interval == 0u)
+		state_hash_log->record(iteration_count, Diagnostics::state_hash(particle_system.particles, particle_system.particle_count));
 
-	for(auto & i : particles)
+	if(c::utilisation_report_interval != 0u && iteration_count % c::utilisation_report_interval == 0u)
 	{
-		// rozwiazanie na kiedy uzyskam dobrze dzialajacy mechanizm kolizji (gdzie czasteczki nie beda wypadac na orbite/poza 'pudelko')
-		glm::vec3 particle_position_vector = i.position;
-		if(out_of_grid_scope(particle_position_vector))
-			continue;
-		int c = get_cell_index(particle_position_vector);//sorted_particles_cell_indexes
-		//int c = get_z_index(get_grid_coords(particle_position_vector));
-
-		//int c = get_cell_index(i.position);
-		//// temporary hack
-		//if(c < 0 || c >= c::C)
-		//	continue;
-
-		if(grid[c].no_particles == 0)
-			grid[c].first_particle = &i;
-
-		++grid[c].no_particles;
+		load_balancer.report_utilisation(std::cout);
+		load_balancer.reset_stats();
 	}
 }
 
-std::vector<Particle> Simulation::extract_surface_particles()
+void Simulation::save_snapshot()
 {
-	using particle_system::get_cell_index;
-	using particle_system::out_of_grid_scope;
-	using particle_system::get_grid_coords_in_real_system;
-	using namespace c;
+	newest_snapshot = (newest_snapshot + 1) % c::no_snapshots;
+	no_snapshots = std::min(no_snapshots + 1, c::no_snapshots);
+	no_rollbacks = 0;
+
+	auto & snapshot = snapshots[newest_snapshot];
+	particle_system.save_state(snapshot.particles);
+	snapshot.emitters = emitters;
+	snapshot.sim_time = sim_time;
+	snapshot.iteration_count = iteration_count;
+}
 
-	auto & grid = this->grid.grid;
+bool Simulation::check_health()
+{
+	auto const & report = diagnostics.last_report();
+	if(report.no_invalid == 0 && report.max_velocity * time_step <= c::max_particle_travel * c::H && report.max_density_error <= c::max_density_error)
+	{
+		if(time_step < c::dt && ++healthy_steps >= c::recovery_steps)
+		{
+			time_step = std::min(2.0f * time_step, c::dt);
+			healthy_steps = 0u;
+		}
+		return true;
+	}
 
-	std::vector<Particle> surface_particles;
-	std::vector<float> threshold_values;
-	surface_particles.reserve(static_cast<unsigned int>(particle_system.particle_count * 0.5f));
-	threshold_values.reserve(particle_system.particle_count);
+	std::cerr << "iteration " << iteration_count << ": blow-up (" << report.no_invalid << " invalid, max |v| " << report.max_velocity
+		<< ", max density error " << report.max_density_error << "), ";
 
-	// go through all grids
-	#pragma omp parallel default(shared)
+	time_step *= 0.5f;
+	healthy_steps = 0u;
+	if(time_step < c::min_time_step)
 	{
-		#pragma omp for schedule(static)
-		//for (auto & i : grid)
-		for(int idx = 0; idx < grid.size(); ++idx)
-		{
-			auto & i = grid[idx];
-			Particle * particle_i_ptr = i.first_particle;
+		std::cerr << "time step would drop below " << c::min_time_step << ", simulation stopped" << std::endl;
+		gave_up = true;
+		return false;
+	}
 
-			// go through all particles in grid [i]
-			for(int ii = 0; ii < i.no_particles; ++ii)
-			{
-				Particle & particle_i = *particle_i_ptr;
-				glm::vec3 center_mass_distance{ 0.f };
-				auto neighbourhood_centre = get_grid_coords_in_real_system(particle_i.position) + glm::vec3(c::dx*0.5f, c::dy*0.5f, c::dz*0.5f);
-				glm::vec3 mass_x_position_sum{ 0.f };
-				auto mass_sum = 0.f;
-				auto neighbourhood_no = 0u;
-
-				// go through neighbours of particle [ii] in grid [i]
-				for(int z = -1; z <= 1; ++z)
-				{
-					for(int y = -1; y <= 1; ++y)
-					{
-						for(int x = -1; x <= 1; ++x)
-						{
-							glm::vec3 neighbour_cell_vector = particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz);
-							//assert(!out_of_grid_scope(neighbour_cell_vector) && "jezus maria jakas czasteczka wyskoczyla!");
-							if(out_of_grid_scope(neighbour_cell_vector))
-								continue;
+	// repeated failures: the newest snapshot may already hold the seed of the instability
+	int const age = std::min(no_rollbacks, no_snapshots - 1);
+	++no_rollbacks;
+	newest_snapshot = (newest_snapshot - age + c::no_snapshots) % c::no_snapshots;
+	no_snapshots -= age;
 
-							int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
+	auto const & snapshot = snapshots[newest_snapshot];
+	particle_system.restore_state(snapshot.particles);
+	emitters = snapshot.emitters;
+	sim_time = snapshot.sim_time;
+	iteration_count = snapshot.iteration_count;
 
-							Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+	std::cerr << "rolled back to iteration " << iteration_count << ", time step " << time_step << std::endl;
+	return false;
+}
 
-							for(int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
-							{
-								Particle& particle_j = *particle_j_ptr;
-								// wydaje mi sie ze position_j_in_neighbourhood powinno byc potraktowane glm::abs()
-								// ale liczac bez wartosci bezwzglednej dostaje lepsze rezultaty
-								glm::vec3 position_j_in_neighbourhood = (neighbourhood_centre - particle_j.position);
-								mass_x_position_sum += c::particleMass * position_j_in_neighbourhood;
-								mass_sum += c::particleMass;
+void Simulation::benchmark_integrators(std::ostream & os, unsigned const no_steps)
+{
+	c::IntegratorType const integrators[] = { c::SYMPLECTIC_EULER, c::VELOCITY_VERLET, c::LEAPFROG_KDK, c::ADAMS_BASHFORTH_2 };
+	char const * const names[] = { integrator::SymplecticEuler::name(), integrator::VelocityVerlet::name(), integrator::LeapfrogKDK::name(), integrator::AdamsBashforth2::name() };
 
-								++neighbourhood_no;
+	os << "integrator benchmark, " << no_steps << " steps, dt " << c::dt << std::endl;
+	os << "integrator\tCPU [s]\twall [s]\tenergy drift\tdrift per CPU-second" << std::endl;
+	for(int i = 0; i < 4; ++i)
+	{
+		// same ids - same initial particles (see Particle::Particle())
+		Particle::no_particles = 0;
+		auto simulation = std::make_unique<Simulation>();
+		simulation->integrator = integrators[i];
+
+		// first step fills densities and forces, its energy is the reference
+		simulation->run(c::dt);
+		double const initial_energy = simulation->mechanical_energy;
+
+		std::clock_t const cpu_start = std::clock();
+		double const wall_start = omp_get_wtime();
+		for(unsigned step = 0u; step < no_steps; ++step)
+			simulation->run(c::dt);
+		double const cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+		double const wall_seconds = omp_get_wtime() - wall_start;
+
+		double const drift = fabs(simulation->mechanical_energy - initial_energy) / fabs(initial_energy);
+		os << names[i] << "\t" << cpu_seconds << "\t" << wall_seconds << "\t" << drift << "\t" << drift / cpu_seconds << std::endl;
+	}
+	Particle::no_particles = 0;
+}
 
-								++particle_j_ptr;
-							}
+namespace
+{
+	// |tier - exact| over pairs; relative to the largest |exact|, since kernels vanish at h
+	struct TierError
+	{
+		double max_error = 0.0, sum_sq_error = 0.0, max_exact = 0.0;
+		int no_samples = 0;
 
-						}
-					}
-				}
+		void add(double const exact, double const value) { add_error(fabs(exact), fabs(value - exact)); }
+		void add(glm::vec3 const exact, glm::vec3 const value) { add_error(glm::length(exact), glm::length(value - exact)); }
 
-				//posumowane
-				center_mass_distance = mass_x_position_sum / mass_sum;
+		void add_error(double const magnitude, double const error)
+		{
+			max_exact = std::max(max_exact, magnitude);
+			max_error = std::max(max_error, error);
+			sum_sq_error += error*error;
+			++no_samples;
+		}
 
-				// if its distance to the center of mass of its neighborhood
-				// is larger than a certain threshold
-				if(glm::length(center_mass_distance) > c::centerMassThreshold || neighbourhood_no <= c::surfaceNeighbourhoodThreshold)
-				{
-					particle_i.at_surface = true;
-					#pragma omp critical
-					surface_particles.emplace_back(particle_i);
-				}
-				else
-					particle_i.at_surface = false;
+		friend std::ostream & operator<<(std::ostream & os, TierError const & e)
+		{
+			double const scale = e.max_exact > 0.0 ? e.max_exact : 1.0;
+			return os << e.max_error / scale << " / " << sqrt(e.sum_sq_error / std::max(e.no_samples, 1)) / scale;
+		}
+	};
 
-				#pragma omp critical
-				threshold_values.push_back(glm::length(center_mass_distance));
+	struct KernelPair
+	{
+		glm::vec3 rVec;
+		float h;
+	};
 
-				++particle_i_ptr;
+	// one row of Simulation::report_math_tiers()
+	template<typename Math>
+	void report_math_tier(std::ostream & os, std::vector<KernelPair> const & pairs)
+	{
+		using math_tier::Exact;
+		int const no_pairs = static_cast<int>(pairs.size());
+		int const no_repetitions = 20;
+
+		// the quantities the density and force passes take from each pair
+		double const start = omp_get_wtime();
+		glm::vec3 sink(0.0f);
+		float scalar_sink = 0.0f;
+		for(int repetition = 0; repetition < no_repetitions; ++repetition)
+		{
+			for(int i = 0; i < no_pairs; ++i)
+			{
+				auto const & pair = pairs[i];
+				float const r = Math::length(pair.rVec);
+				scalar_sink += kernel::W_poly6<Math>(r*r, pair.h*pair.h, pair.h) + kernel::LapW_poly6<Math>(r, pair.h);
+				sink += kernel::GradW_poly6<Math>(r, pair.h)*pair.rVec + kernel::GradW_spiky<Math>(r, pair.h)*pair.rVec + kernel::Grad_BicubicSpline<Math>(pair.rVec, pair.h);
 			}
 		}
+		double const ns_per_pair = (omp_get_wtime() - start) * 1e9 / std::max(no_pairs*no_repetitions, 1);
+		volatile float const used = scalar_sink + sink.x + sink.y + sink.z;// the timed loop is not optimised away
+		(void)used;
+
+		TierError r_error, W_error, gradW_error, lapW_error, spiky_error, spline_error;
+		for(auto const & pair : pairs)
+		{
+			float const r_sq = glm::dot(pair.rVec, pair.rVec), h_sq = pair.h*pair.h;
+			float const r_exact = Exact::sqrt(r_sq), r = Math::sqrt(r_sq);
+			r_error.add(r_exact, r);
+			W_error.add(kernel::W_poly6<Exact>(r_sq, h_sq, pair.h), kernel::W_poly6<Math>(r_sq, h_sq, pair.h));
+			gradW_error.add(kernel::GradW_poly6<Exact>(r_exact, pair.h)*pair.rVec, kernel::GradW_poly6<Math>(r, pair.h)*pair.rVec);
+			lapW_error.add(kernel::LapW_poly6<Exact>(r_exact, pair.h), kernel::LapW_poly6<Math>(r, pair.h));
+			spiky_error.add(kernel::GradW_spiky<Exact>(r_exact, pair.h)*pair.rVec, kernel::GradW_spiky<Math>(r, pair.h)*pair.rVec);
+			spline_error.add(kernel::Grad_BicubicSpline<Exact>(pair.rVec, pair.h), kernel::Grad_BicubicSpline<Math>(pair.rVec, pair.h));
+		}
+
+		os << Math::name() << "\t" << ns_per_pair << "\t" << r_error << "\t" << W_error << "\t" << gradW_error << "\t" << lapW_error
+			<< "\t" << spiky_error << "\t" << spline_error << std::endl;
+	}
+} // namespace anonymous
+
+void Simulation::report_math_tiers(std::ostream & os, unsigned const no_steps)
+{
+	using particle_system::minimum_image;
+
+	Particle::no_particles = 0;
+	auto simulation = std::make_unique<Simulation>();
+	for(unsigned step = 0u; step < no_steps; ++step)
+		simulation->run(c::dt);
+
+	// pairs of the last neighbour search, at the positions after the step (r <= h still for almost all of them)
+	auto const & particles = simulation->particle_system.particles;
+	auto const & offsets = simulation->neighbour_list.get_offsets();
+	auto const & neighbours = simulation->neighbour_list.get_neighbours();
+	std::vector<KernelPair> pairs;
+	for(int slot = 0; slot < simulation->neighbour_list.get_no_particles(); ++slot)
+	{
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			Particle const & particle_j = particles[neighbours[n].slot];
+			glm::vec3 const rVec = minimum_image(particles[slot].position - particle_j.position);
+			float const h = kernel::symmetric(particles[slot].h, particle_j.h);
+			if(glm::dot(rVec, rVec) > 0.0f && glm::dot(rVec, rVec) < h*h)
+				pairs.push_back({ rVec, h });
+		}
 	}
 
-	return surface_particles;
+	os << "math tier report, " << pairs.size() << " pairs after " << no_steps << " steps (errors: max / rms, relative to max |exact|)" << std::endl;
+	os << "tier\tns per pair\tr\tW poly6\tgradW poly6\tlapW poly6\tgradW spiky\tgradW spline" << std::endl;
+	report_math_tier<math_tier::Exact>(os, pairs);
+	report_math_tier<math_tier::NewtonRsqrt>(os, pairs);
+	report_math_tier<math_tier::Approximate>(os, pairs);
+	Particle::no_particles = 0;
 }
 
-std::vector<Particle> Simulation::extract_surface_particles_2()
+void Simulation::bin_particles_in_grid()
 {
+	using particle_system::get_cell_index;
+	using particle_system::out_of_grid_scope;
+	using particle_system::get_grid_coords;
+	using particle_system::get_z_index;
+
 	auto & particles = particle_system.particles;
-	std::vector<Particle> surface_particles;
-	surface_particles.reserve(static_cast<unsigned int>(particle_system.particle_count * 0.8f));
+	auto & grid = this->grid.grid;
+	this->grid.max_h = 0.0f;
 
-	for(auto & particle : particles)
+	for(int idx = 0; idx < particle_system.particle_count; ++idx)
 	{
-		if(particle.at_surface == true)
-			surface_particles.emplace_back(particle);
+		auto & i = particles[idx];
+		// rozwiazanie na kiedy uzyskam dobrze dzialajacy mechanizm kolizji (gdzie czasteczki nie beda wypadac na orbite/poza 'pudelko')
+		glm::vec3 particle_position_vector = i.position;
+		if(out_of_grid_scope(particle_position_vector))
+			continue;
+		int c = get_cell_index(particle_position_vector);//sorted_particles_cell_indexes
+		//int c = get_z_index(get_grid_coords(particle_position_vector));
+
+		//int c = get_cell_index(i.position);
+		//// temporary hack
+		//if(c < 0 || c >= c::C)
+		//	continue;
+
+		if(grid[c].no_particles == 0)
+			grid[c].first_particle = &i;
+
+		++grid[c].no_particles;
+		grid[c].max_h = std::max(grid[c].max_h, i.h);
+		this->grid.max_h = std::max(this->grid.max_h, i.h);
 	}
 
-	return surface_particles;
+	// prefix sums are the weights for chunking cell loops
+	auto & particle_offsets = this->grid.particle_offsets;
+	particle_offsets[0] = 0;
+	for(int idx = 0; idx < c::C; ++idx)
+		particle_offsets[idx + 1] = particle_offsets[idx] + grid[idx].no_particles;
+	this->grid.spread_max_h();
+
+	load_balancer.partition(particle_offsets);
 }
 
 void Simulation::emit_particles()
@@ -205,296 +387,545 @@ void Simulation::emit_particles()
 		//	for(float y = ymin*placement_mod - 0.25f; y < ymax*placement_mod; y += c::H*additional_margin)
 		//		for(float z = zmin*placement_mod - 0.1f; z < zmax*placement_mod + 0.1f; z += c::H*additional_margin)
 
+		// 2D: a single layer at z = 0
+		float const z_first = c::dimensions == 3 ? c::zmin*placement_mod - 0.1f : 0.0f;
+		float const z_end = c::dimensions == 3 ? c::zmax*placement_mod + 0.1f : c::H*additional_margin;
+
 		for (float y = c::ymin + 2.0f*c::H; y < c::ymax*placement_mod; y += c::H*additional_margin)
-			for (float z = c::zmin*placement_mod - 0.1f; z < c::zmax*placement_mod + 0.1f; z += c::H*additional_margin)
+			for (float z = z_first; z < z_end; z += c::H*additional_margin)
 				for (float x = c::xmin*placement_mod; x < c::xmax*placement_mod; x += c::H*additional_margin)
 				{
 					Particle& tp = particles[particle_count];
 					tp.position = glm::vec3(x, y, z);
 					tp.velocity = glm::vec3(0.0f);
-					//tp.eval_velocity = glm::vec3(0.0f);
-					//tp.previous_position = tp.position;
 					++particle_count;
 					if (particle_count >= c::N)
 						return;
 				}
 	}
 
+	// outflow before inflow: freed slots are reused after the next sort
+	emitters.absorb();
 	if(emitters.is_any_emitter_alive())
-		emitters.emit();
+		emitters.emit(time_step);
+}
+
+void Simulation::compute_reaction_diffusion()
+{
+	if(reaction_diffusion.get_no_species() == 0)
+		return;
+
+	if(c::diffusion_solver == c::LATTICE)
+	{
+		reaction_diffusion.step_on_lattice(particle_system, grid.particle_offsets, time_step);
+		return;
+	}
+
+	auto const & particles = particle_system.particles;
+	auto const & offsets = neighbour_list.get_offsets();
+	auto const & neighbours = neighbour_list.get_neighbours();
+	int const no_particles = neighbour_list.get_no_particles();
+	diffusion_weights.resize(neighbour_list.get_no_pairs());
+
+	// concentration independent: computed once, reused by every sub-step / sweep
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			auto const & particle_j = particles[neighbours[n].slot];
+			diffusion_weights[n] = (particle_j.mass / (particle_j.density + particles[slot].density))*kernel::LapW_viscosity(neighbours[n].r, kernel::symmetric(particles[slot].h, particle_j.h));
+		}
+	}
+
+	reaction_diffusion.step(particle_system, neighbour_list, diffusion_weights, time_step);
 }
 
-void Simulation::compute_nutrient_concentration()
+void Simulation::compute_density()
+{
+	switch(c::precision)
+	{
+	case c::SINGLE_PRECISION: compute_density_with<precision::Single>(); break;
+	case c::MIXED_PRECISION: compute_density_with<precision::Mixed>(); break;
+	case c::DOUBLE_PRECISION: compute_density_with<precision::Double>(); break;
+	}
+}
+
+template<typename Precision>
+void Simulation::compute_density_with()
 {
 	using particle_system::get_cell_index;
 	using particle_system::out_of_grid_scope;
+	using particle_system::wrap_position;
+	using particle_system::minimum_image;
 	using namespace c;
-	const float h_sq = c::H*c::H;
+	using Real = typename Precision::Real;
+	using PairVector = typename Precision::PairVector;
+	using Math = typename Precision::Math;
 
 	auto & grid = this->grid.grid;
-
+	Particle const * const first_particle = particle_system.particles.data();
+	auto const & neighbourhood_max_h = this->grid.neighbourhood_max_h;
+	neighbour_list.reset(particle_system.particle_count, load_balancer.no_threads());
+	
 	// go through all grids
-	#pragma omp parallel default(shared)
+	load_balancer.for_each_cell([&](int idx)
 	{
-		// for (auto & i : grid)
-		#pragma omp for schedule(static) 
-		for(int idx = 0; idx < grid.size(); ++idx)
+		int const thread_id = omp_get_thread_num();
+		auto & i = grid[idx];
+		Particle * particle_i_ptr = i.first_particle;
+
+		// go through all particles in grid [i]
+		for (int ii = 0; ii < i.no_particles; ++ii)
 		{
-			auto & i = grid[idx];
-			Particle * particle_i_ptr = i.first_particle;
+			Particle & particle_i = *particle_i_ptr;
+			typename Precision::Scalar density(0.0f);
+			int const row = neighbour_list.start_row(thread_id);
 
-			// go through all particles in grid [i]
-			for(int ii = 0; ii < i.no_particles; ++ii)
-			{
-				Particle & particle_i = *particle_i_ptr;
-				auto nutrient = 0.0f;
+			// every pair of particle_i has a support radius up to this one
+			float const search_radius = kernel::symmetric(particle_i.h, neighbourhood_max_h[idx]);
+			glm::ivec3 const reach = Grid::get_reach(search_radius);
+			float const cull_distance_sq = pow(search_radius + PositionCache::get_margin(), 2);
 
-				// go through neighbours of particle [ii] in grid [i]
-				for(int z = -1; z <= 1; ++z)
+			// go through neighbours of particle [ii] in grid [i]
+			for (int z = -reach.z; z <= reach.z; ++z)
+			{
+				for (int y = -reach.y; y <= reach.y; ++y)
 				{
-					for(int y = -1; y <= 1; ++y)
+					for (int x = -reach.x; x <= reach.x; ++x)
 					{
-						for(int x = -1; x <= 1; ++x)
-						{
-							glm::vec3 neighbour_cell_vector = particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz);
-							if(out_of_grid_scope(neighbour_cell_vector))
-								continue;
+						glm::vec3 neighbour_cell_vector = wrap_position(particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz));
+						if (out_of_grid_scope(neighbour_cell_vector))
+							continue;
 
-							int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
-							if(neighbour_grid_idx < 0 || neighbour_grid_idx >= c::C)
-								continue;
+						int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
+						if (neighbour_grid_idx < 0 || neighbour_grid_idx >= c::C)
+							continue;
 
-							Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+						// beyond the first ring only cells with particles large enough to reach particle_i
+						bool const outer_cell = std::abs(x) > 1 || std::abs(y) > 1 || std::abs(z) > 1;
+						if (outer_cell && kernel::symmetric(particle_i.h, grid[neighbour_grid_idx].max_h) <= Grid::get_gap(glm::ivec3(x, y, z)))
+							continue;
 
-							for(int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
-							{
-								Particle& particle_j = *particle_j_ptr;
+						Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+						glm::vec3 const cell_min = c::position_cache ? PositionCache::get_cell_min(neighbour_grid_idx) : glm::vec3(0.0f);
 
-								glm::vec3 rVec = particle_i.position - particle_j.position;
-								float r_sq = dot(rVec, rVec);
-								float r = sqrt(r_sq);
-
-								if(r > c::H)
+						for (int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
+						{
+							if(c::position_cache)
+							{
+								glm::vec3 const approximate_rVec = minimum_image(particle_i.position - position_cache.decode(static_cast<int>(particle_j_ptr - first_particle), cell_min));
+								if(dot(approximate_rVec, approximate_rVec) > cull_distance_sq)
 								{
 									++particle_j_ptr;
 									continue;
 								}
+							}
+
+							Particle& particle_j = *particle_j_ptr;
 
-								nutrient += (particle_j.nutrient - particle_i.nutrient)*(c::particleMass / (particle_j.density + particle_i.density))*LapW_viscosity(r, c::H);
+							PairVector rVec(minimum_image(particle_i.position - particle_j.position));
+							Real r_sq = dot(rVec, rVec);
+							Real r = Math::sqrt(r_sq);
+							Real const h = kernel::symmetric(particle_i.h, particle_j.h);
 
+							if (r > h)
+							{
 								++particle_j_ptr;
+								continue;
 							}
 
+							density += particle_j.mass*kernel::W_poly6<Math>(r_sq, h*h, h);
+							if (particle_j_ptr != particle_i_ptr)
+								neighbour_list.add(thread_id, static_cast<int>(particle_j_ptr - first_particle), static_cast<float>(r));
+
+							++particle_j_ptr;
 						}
+
 					}
 				}
+			}
 
-				nutrient *= c::nutrient_diffusion;
-				nutrient -= c::nutrient_consumption_rate;
-
-				// compute nutrient concentration
-				particle_i.new_nutrient = nutrient;
+			neighbour_list.end_row(thread_id, static_cast<int>(particle_i_ptr - first_particle), row);
 
-				++particle_i_ptr;
+			// walls as neighbours: boundary particle of volume V_b weighs restDensity*V_b
+			if(c::boundary_handling == c::BOUNDARY_PARTICLES)
+			{
+				// boundary particles are sampled for c::H
+				float const h = kernel::symmetric(particle_i.h, c::H);
+				boundary_particles.for_each_neighbour(particle_i.position, h, [&](BoundaryParticle const & particle_b, glm::vec3 const, float const r)
+				{
+					if(r <= h)
+						density += c::restDensity*particle_b.volume*kernel::W_poly6(r*r, h*h, h);
+				});
 			}
+
+			particle_i.density = static_cast<float>(density);
+
+			// compute pressure
+			particle_i.pressure = c::gasStiffness * (pow(particle_i.density / c::restDensity, 7) - 1.0f);// Tait equation
+			//particle_i.pressure = c::gasStiffness * (particle_i.density - c::restDensity);
+
+			++particle_i_ptr;
 		}
-	}
+	});
 
-	auto & particles = particle_system.particles;
+	neighbour_list.finalize();
+}
 
-	//#pragma omp parallel default(shared)
+void Simulation::compute_forces()
+{
+	switch(c::precision)
 	{
-		//#pragma omp for schedule(static)
-		//for (auto & p : particles)
-		for(int idx = 0; idx < particles.size(); ++idx)
-		{
-			auto & p = particles[idx];
-
-			p.nutrient = p.nutrient + p.new_nutrient*c::dt*0.2f;
+	case c::SINGLE_PRECISION: compute_forces_with<precision::Single>(); break;
+	case c::MIXED_PRECISION: compute_forces_with<precision::Mixed>(); break;
+	case c::DOUBLE_PRECISION: compute_forces_with<precision::Double>(); break;
+	}
 
-		}
+	if(wanted_fields & SURFACE_FLAGS)
+	{
+		auto const & particles = particle_system.particles;
+		surface_slots.clear();
+		for(int slot = 0; slot < particle_system.particle_count; ++slot)
+			if(particles[slot].at_surface)
+				surface_slots.push_back(slot);
 	}
 }
 
-void Simulation::compute_density()
+template<typename Precision>
+void Simulation::compute_forces_with()
 {
 	using particle_system::get_cell_index;
 	using particle_system::out_of_grid_scope;
+	using particle_system::wrap_position;
+	using particle_system::minimum_image;
+	using particle_system::get_grid_coords_in_real_system;
 	using namespace c;
-	const float h_sq = c::H*c::H;
+	using Vector = typename Precision::Vector;
+	using Real = typename Precision::Real;
+	using PairVector = typename Precision::PairVector;
+	using Math = typename Precision::Math;
+	// const float h_sq = c::H*c::H;
 
 	auto & grid = this->grid.grid;
-	
+	Particle const * const first_particle = particle_system.particles.data();
+	auto const & neighbourhood_max_h = this->grid.neighbourhood_max_h;
+	bool const color_field = (wanted_fields & COLOR_FIELD) != 0u;
+	bool const classify_surface = (wanted_fields & SURFACE_FLAGS) != 0u;
+	float * const color_field_gradient_magnitudes = particle_system.get_channel(particle_system.color_field_gradient_magnitude_channel);
+
 	// go through all grids
-	#pragma omp parallel default(shared)
+	load_balancer.for_each_cell([&](int idx)
 	{
-		#pragma omp for schedule(static) 
-		//for (auto & i : grid)
-		for (int idx = 0; idx < grid.size(); ++idx)
-		{
-			auto & i = grid[idx];
-			Particle * particle_i_ptr = i.first_particle;
+		auto & i = grid[idx];
+		Particle * particle_i_ptr = i.first_particle;
 
-			// go through all particles in grid [i]
-			for (int ii = 0; ii < i.no_particles; ++ii)
+		// go through all particles in grid [i]
+		for (int ii = 0; ii < i.no_particles; ++ii)
+		{
+			Particle & particle_i = *particle_i_ptr;
+
+			// every pair of particle_i has a support radius up to this one
+			float const search_radius = kernel::symmetric(particle_i.h, neighbourhood_max_h[idx]);
+			glm::ivec3 const reach = Grid::get_reach(search_radius);
+			float const cull_distance_sq = pow(search_radius + PositionCache::get_margin(), 2);
+
+			glm::vec3 totalF(0.0f);
+			glm::vec3 externalF(0.0f), surfacetensionF(0.0f);
+			Vector pressure_sum(0.0f), viscosity_sum(0.0f), color_field_gradient_sum(0.0f);
+			typename Precision::Scalar color_field_laplacian_sum(0.0f);
+
+			// surface particle: far from the centre of mass of the particles in the 3^D cells around (whatever the reach), or few of them
+			glm::vec3 const neighbourhood_centre = classify_surface ? get_grid_coords_in_real_system(particle_i.position) + glm::vec3(c::dx*0.5f, c::dy*0.5f, c::dz*0.5f) : glm::vec3(0.0f);
+			glm::vec3 mass_x_position_sum(0.0f);
+			float mass_sum = 0.0f;
+			unsigned neighbourhood_no = 0u;
+
+			// go through neighbours of particle [ii] in grid [i]
+			for (int z = -reach.z; z <= reach.z; ++z)
 			{
-				Particle & particle_i = *particle_i_ptr;
-				particle_i.density = 0.0f;
-
-				// go through neighbours of particle [ii] in grid [i]
-				for (int z = -1; z <= 1; ++z)
+				for (int y = -reach.y; y <= reach.y; ++y)
 				{
-					for (int y = -1; y <= 1; ++y)
+					for (int x = -reach.x; x <= reach.x; ++x)
 					{
-						for (int x = -1; x <= 1; ++x)
-						{
-							glm::vec3 neighbour_cell_vector = particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz);
-							if (out_of_grid_scope(neighbour_cell_vector))
-								continue;
+						glm::vec3 neighbour_cell_vector = wrap_position(particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz));
+						if (out_of_grid_scope(neighbour_cell_vector))
+							continue;
 
-							int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
-							if (neighbour_grid_idx < 0 || neighbour_grid_idx >= c::C)
-								continue;
+						int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
+						if (neighbour_grid_idx < 0 || neighbour_grid_idx >= c::C)
+							continue;
 
-							Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+						// beyond the first ring only cells with particles large enough to reach particle_i
+						bool const outer_cell = std::abs(x) > 1 || std::abs(y) > 1 || std::abs(z) > 1;
+						if (outer_cell && kernel::symmetric(particle_i.h, grid[neighbour_grid_idx].max_h) <= Grid::get_gap(glm::ivec3(x, y, z)))
+							continue;
 
-							for (int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
-							{
-								Particle& particle_j = *particle_j_ptr;
+						Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+						glm::vec3 const cell_min = c::position_cache ? PositionCache::get_cell_min(neighbour_grid_idx) : glm::vec3(0.0f);
+						bool const classification_cell = classify_surface && std::abs(x) <= 1 && std::abs(y) <= 1 && std::abs(z) <= 1;
 
-								glm::vec3 rVec = particle_i.position - particle_j.position;
-								float r_sq = dot(rVec, rVec);
-								float r = sqrt(r_sq);
-
-								if (r > c::H)
+						for (int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
+						{
+							// every particle of the cells counts, so no culling on classification steps
+							if(classification_cell)
+							{
+								Particle const & candidate = *particle_j_ptr;
+								mass_x_position_sum += candidate.mass * minimum_image(neighbourhood_centre - candidate.position);
+								mass_sum += candidate.mass;
+								++neighbourhood_no;
+							}
+							else if(c::position_cache)
+							{
+								glm::vec3 const approximate_rVec = minimum_image(particle_i.position - position_cache.decode(static_cast<int>(particle_j_ptr - first_particle), cell_min));
+								if(dot(approximate_rVec, approximate_rVec) > cull_distance_sq)
 								{
 									++particle_j_ptr;
 									continue;
 								}
+							}
+
+							Particle& particle_j = *particle_j_ptr;
 
-								particle_i.density += c::particleMass*W_poly6(r_sq, h_sq, c::H);
+							PairVector rVec(minimum_image(particle_i.position - particle_j.position));
+							Real r = Math::length(rVec);
+							Real const h = kernel::symmetric(particle_i.h, particle_j.h);
 
+							if (r > h)
+							{
 								++particle_j_ptr;
+								continue;
 							}
 
-						}
-					}
-				}
+							if(color_field)
+							{
+								PairVector gradW_poly = kernel::GradW_poly6<Math>(r, h)*rVec;
+								color_field_gradient_sum += Vector(static_cast<Real>(particle_j.mass)*gradW_poly / static_cast<Real>(particle_j.density));
+								color_field_laplacian_sum += particle_j.mass*kernel::LapW_poly6<Math>(r, h) / particle_j.density;
+							}
 
-				// compute pressure
-				particle_i.pressure = c::gasStiffness * (pow(particle_i.density / c::restDensity, 7) - 1.0f);// Tait equation
-				//particle_i.pressure = c::gasStiffness * (particle_i.density - c::restDensity);
+							if (particle_i.id == particle_j.id)
+							{
+								++particle_j_ptr;
+								continue;
+							}
 
-				++particle_i_ptr;
-			}
-		}
-	}
-}
+							//viscosityF += (particle_j.velocity - particle_i.velocity)*LapW_viscosity(r, c::H)*c::particleMass / particle_i.density;
 
-void Simulation::compute_forces()
-{
-	using particle_system::get_cell_index;
-	using particle_system::out_of_grid_scope;
-	using namespace c;
-	// const float h_sq = c::H*c::H;
+							if(c::viscosity_solver == c::EXPLICIT_VISCOSITY)
+								viscosity_sum += Vector(static_cast<Real>(2.0f * particle_j.mass / (particle_j.density + particle_i.density)) * PairVector(particle_i.velocity - particle_j.velocity) * ((rVec * kernel::Grad_BicubicSpline<Math>(rVec, static_cast<float>(h))) / (rVec * rVec + 0.01f*pow(h, 2))));
 
-	auto & grid = this->grid.grid;
+							//pressureF -= (0.5f*(particle_j.pressure + particle_i.pressure) / (particle_j.density)*c::particleMass)*GradW_spiky(r, c::H)*rVec;
 
-	// go through all grids
-	#pragma omp parallel default(shared)
-	{
-		#pragma omp for schedule(static)
-		for (int idx = 0; idx < grid.size(); ++idx)
-		{
-			auto & i = grid[idx];
-			Particle * particle_i_ptr = i.first_particle;
+							pressure_sum += Vector(static_cast<Real>(particle_j.mass*(particle_j.pressure / pow(particle_j.density, 2) + particle_i.pressure / pow(particle_i.density, 2)))*PairVector(kernel::GradW_spiky<Math>(r, h))*rVec);
 
-			// go through all particles in grid [i]
-			for (int ii = 0; ii < i.no_particles; ++ii)
+							++particle_j_ptr;
+						}
+					}
+				}
+			}
+
+			// pressure and friction from walls (boundary particles do not move, v_b = 0)
+			if(c::boundary_handling == c::BOUNDARY_PARTICLES)
 			{
-				Particle & particle_i = *particle_i_ptr;
+				float const h = kernel::symmetric(particle_i.h, c::H);
+				boundary_particles.for_each_neighbour(particle_i.position, h, [&](BoundaryParticle const & particle_b, glm::vec3 const rVec, float const r)
+				{
+					if(r <= 0.0f || r > h)
+						return;
 
-				glm::vec3 totalF(0.0f);
-				glm::vec3 pressureF(0.0f), viscosityF(0.0f), externalF(0.0f), surfacetensionF(0.0f);
-				glm::vec3 colorFieldGrad(0.0f);
-				float colorFieldLap(0.0f);
+					float const boundary_mass = c::restDensity*particle_b.volume;
+					if(c::viscosity_solver == c::EXPLICIT_VISCOSITY)
+						viscosity_sum += Vector(2.0f * boundary_mass / (c::restDensity + particle_i.density) * particle_i.velocity * ((rVec * kernel::Grad_BicubicSpline(rVec, h)) / (rVec * rVec + 0.01f*pow(h, 2))));
+					pressure_sum += Vector(boundary_mass*(particle_i.pressure / pow(particle_i.density, 2))*glm::vec3(kernel::GradW_spiky(r, h))*rVec);
+				});
+			}
 
-				// go through neighbours of particle [ii] in grid [i]
-				for (int z = -1; z <= 1; ++z)
-				{
-					for (int y = -1; y <= 1; ++y)
-					{
-						for (int x = -1; x <= 1; ++x)
-						{
-							glm::vec3 neighbour_cell_vector = particle_i.position + glm::vec3(x*c::dx, y*c::dy, z*c::dz);
-							if (out_of_grid_scope(neighbour_cell_vector))
-								continue;
+			glm::vec3 pressureF(pressure_sum), viscosityF(viscosity_sum);
+			glm::vec3 colorFieldGrad(color_field_gradient_sum);
+			float colorFieldLap = static_cast<float>(color_field_laplacian_sum);
 
-							int neighbour_grid_idx = get_cell_index(neighbour_cell_vector);
-							if (neighbour_grid_idx < 0 || neighbour_grid_idx >= c::C)
-								continue;
+			if(classify_surface)
+				particle_i.at_surface = glm::length(mass_x_position_sum / mass_sum) > c::centerMassThreshold || neighbourhood_no <= c::surfaceNeighbourhoodThreshold;
 
-							Particle * particle_j_ptr = grid[neighbour_grid_idx].first_particle;
+			float colorFieldGradMag = glm::length(colorFieldGrad);
+			if (colorFieldGradMag > c::surfaceThreshold)
+				surfacetensionF = -c::surfaceTension*colorFieldLap*colorFieldGrad / colorFieldGradMag;// -sigma*nabla^{2}[c_s]*(nabla[c_s]/|nabla[c_s]|)
 
-							for (int j = 0; j < grid[neighbour_grid_idx].no_particles; ++j)
-							{
-								Particle& particle_j = *particle_j_ptr;
+			pressureF *= -particle_i.density;
+			viscosityF *= c::viscosity;// *particle_i.density;
+			externalF = glm::vec3(0.0f, c::gravityAcc*particle_i.density, 0.0f);
 
-								glm::vec3 rVec = particle_i.position - particle_j.position;
-								float r = glm::length(rVec);
+			totalF = pressureF + viscosityF + surfacetensionF + externalF;
 
-								if (r > c::H)
-								{
-									++particle_j_ptr;
-									continue;
-								}
+			particle_i.acc = totalF / particle_i.density;
+			if(color_field)
+				color_field_gradient_magnitudes[particle_i_ptr - first_particle] = colorFieldGradMag;
 
-								glm::vec3 gradW_poly = GradW_poly6(r, c::H)*rVec;
-								colorFieldGrad += c::particleMass*gradW_poly / particle_j.density;
-								colorFieldLap += c::particleMass*LapW_poly6(r, c::H) / particle_j.density;
+			++particle_i_ptr;
 
-								if (particle_i.id == particle_j.id)
-								{
-									++particle_j_ptr;
-									continue;
-								}
+		}
+	});
+}
 
-								//viscosityF += (particle_j.velocity - particle_i.velocity)*LapW_viscosity(r, c::H)*c::particleMass / particle_i.density;
+void Simulation::adapt_resolution()
+{
+	using particle_system::wrap_position;
+	using particle_system::minimum_image;
 
-								viscosityF += 2.0f * c::particleMass / (particle_j.density + particle_i.density) * (particle_i.velocity - particle_j.velocity) * ((rVec * Grad_BicubicSpline(rVec, c::H)) / (rVec * rVec + 0.01f*pow(c::H, 2)));
+	if(!c::adaptive_resolution || iteration_count % c::adaptivity_interval != 0u)
+		return;
 
-								//pressureF -= (0.5f*(particle_j.pressure + particle_i.pressure) / (particle_j.density)*c::particleMass)*GradW_spiky(r, c::H)*rVec;
+	auto & particles = particle_system.particles;
+	auto const & offsets = neighbour_list.get_offsets();
+	auto const & neighbours = neighbour_list.get_neighbours();
+	int const no_particles = neighbour_list.get_no_particles();// those of the last density pass
+	float const min_mass = c::particleMass / static_cast<float>(1 << c::max_refinement_level);
+	float const max_mass = c::particleMass * static_cast<float>(1 << c::max_coarsening_level);
+	adapted.assign(no_particles, 0);
+
+	// copied: clone_particle() may grow storage and reallocate channels
+	float const * const gradient_magnitudes = particle_system.get_channel(particle_system.color_field_gradient_magnitude_channel);
+	adaptivity_indicators.resize(no_particles);
+	for(int slot = 0; slot < no_particles; ++slot)
+		adaptivity_indicators[slot] = gradient_magnitudes[slot] * particles[slot].h;
+
+	auto const indicator = [&](int const slot) { return adaptivity_indicators[slot]; };
+	auto const mergeable = [&](int const slot) { return !adapted[slot] && particles[slot].alive && particles[slot].mass < max_mass && indicator(slot) < c::merge_indicator; };
+
+	// merges first: a bulk pair becomes one particle at its centre of mass
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		if(!mergeable(slot))
+			continue;
 
-								pressureF += c::particleMass*(particle_j.pressure / pow(particle_j.density, 2) + particle_i.pressure / pow(particle_i.density, 2))*GradW_spiky(r, c::H)*rVec;
+		auto & particle_i = particles[slot];
+		int partner = -1;
+		float partner_r = c::merge_radius * particle_i.h;
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			int const j = neighbours[n].slot;
+			if(neighbours[n].r < partner_r && particles[j].mass == particle_i.mass && mergeable(j))
+			{
+				partner = j;
+				partner_r = neighbours[n].r;
+			}
+		}
+		if(partner == -1)
+			continue;
 
-								++particle_j_ptr;
-							}
-						}
-					}
-				}
+		auto const & particle_j = particles[partner];
+		float const mass = particle_i.mass + particle_j.mass;
+		float const weight = particle_j.mass / mass;
+		particle_i.position = wrap_position(particle_i.position + weight * minimum_image(particle_j.position - particle_i.position));
+		particle_i.velocity = (particle_i.mass * particle_i.velocity + particle_j.mass * particle_j.velocity) / mass;
+		particle_i.acc = (particle_i.mass * particle_i.acc + particle_j.mass * particle_j.acc) / mass;
+		particle_i.mass = mass;
+		particle_i.h = c::H * dimension::Current::h_scale(mass / c::particleMass);
+		particle_system.blend_channels(slot, partner, weight);
+		particle_system.kill(partner);
+		adapted[slot] = adapted[partner] = 1;
+	}
+
+	// then splits: two half-mass daughters on a random axis through the parent, same velocity
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		if(adapted[slot] || !particles[slot].alive || particles[slot].mass < 1.5f * min_mass || indicator(slot) <= c::split_indicator)
+			continue;
 
-				float colorFieldGradMag = glm::length(colorFieldGrad);
-				if (colorFieldGradMag > c::surfaceThreshold)
-					surfacetensionF = -c::surfaceTension*colorFieldLap*colorFieldGrad / colorFieldGradMag;// -sigma*nabla^{2}[c_s]*(nabla[c_s]/|nabla[c_s]|)
+		uint64_t const counter = static_cast<uint64_t>(particles[slot].id) | static_cast<uint64_t>(iteration_count) << 32;
+		float const z = rng::uniform(rng::PARTICLE_SPLIT_Z, counter, -1.0f, 1.0f);
+		float const phi = rng::uniform(rng::PARTICLE_SPLIT_PHI, counter, 0.0f, 2.0f * c::PIf);
+		float const radius = c::dimensions == 3 ? std::sqrt(1.0f - z*z) : 1.0f;// 2D: axis in the plane
+		glm::vec3 const axis(radius * std::cos(phi), radius * std::sin(phi), c::dimensions == 3 ? z : 0.0f);
+
+		float const mass = 0.5f * particles[slot].mass;
+		float const h = c::H * dimension::Current::h_scale(mass / c::particleMass);
+		glm::vec3 const offset = c::split_separation * h * axis;
+
+		int const copy = particle_system.clone_particle(slot);
+		particles[slot].mass = particles[copy].mass = mass;
+		particles[slot].h = particles[copy].h = h;
+		particles[slot].position = wrap_position(particles[slot].position + offset);
+		particles[copy].position = wrap_position(particles[copy].position - offset);
+	}
+}
+
+void Simulation::compute_implicit_viscosity()
+{
+	auto const & particles = particle_system.particles;
+	auto const & offsets = neighbour_list.get_offsets();
+	auto const & neighbours = neighbour_list.get_neighbours();
+	int const no_particles = neighbour_list.get_no_particles();
+	viscosity_weights.resize(neighbour_list.get_no_pairs());
+	boundary_viscosity_weights.resize(c::boundary_handling == c::BOUNDARY_PARTICLES ? no_particles : 0);
+
+	// scalar pair term -(rVec . GradW) / (r^2 + 0.01 h^2): depends on r only and is >= 0, as a symmetric positive definite matrix needs;
+	// not the term of the explicit viscosity in compute_forces(), which multiplies rVec * GradW and divides by rVec * rVec + 0.01 h^2
+	// per component (a direction-dependent weight; the scalar term sums numerator and denominator over components), so the two modes differ
+	// beyond the time integration;
+	// rows are scaled by m_i, so weights are symmetric for any masses (see ImplicitViscosity)
+	auto const pair_term = [](float const r, float const h)
+	{
+		return r > 0.0f && r <= h ? -r * kernel::Grad_BicubicSpline(glm::vec3(r, 0.0f, 0.0f), h).x / (r*r + 0.01f*h*h) : 0.0f;
+	};
 
-				if (colorFieldGradMag > c::surfaceParticleGradientThreshold)
-					particle_i.at_surface = false;
-				else
-					particle_i.at_surface = false;
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		auto const & particle_i = particles[slot];
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			auto const & particle_j = particles[neighbours[n].slot];
+			viscosity_weights[n] = 2.0f * particle_i.mass * particle_j.mass / (particle_j.density + particle_i.density) * pair_term(neighbours[n].r, kernel::symmetric(particle_i.h, particle_j.h));
+		}
 
-				pressureF *= -particle_i.density;
-				viscosityF *= c::viscosity;// *particle_i.density;
-				externalF = glm::vec3(0.0f, c::gravityAcc*particle_i.density, 0.0f);
+		if(c::boundary_handling == c::BOUNDARY_PARTICLES)
+		{
+			float const h = kernel::symmetric(particle_i.h, c::H);
+			float boundary_sum = 0.0f;
+			boundary_particles.for_each_neighbour(particle_i.position, h, [&](BoundaryParticle const & particle_b, glm::vec3 const, float const r)
+			{
+				boundary_sum += 2.0f * c::restDensity*particle_b.volume / (c::restDensity + particle_i.density) * pair_term(r, h);
+			});
+			boundary_viscosity_weights[slot] = particle_i.mass * boundary_sum;
+		}
+	}
 
-				totalF = pressureF + viscosityF + surfacetensionF + externalF;
+	implicit_viscosity.solve(particle_system, neighbour_list, viscosity_weights, boundary_viscosity_weights, time_step);
+}
 
-				particle_i.acc = totalF / particle_i.density;
-				particle_i.color_field_gradient_magnitude = colorFieldGradMag;
+void Simulation::compute_vorticity()
+{
+	using particle_system::minimum_image;
 
-				++particle_i_ptr;
+	auto const & particles = particle_system.particles;
+	auto const & offsets = neighbour_list.get_offsets();
+	auto const & neighbours = neighbour_list.get_neighbours();
+	int const no_particles = neighbour_list.get_no_particles();
+	float * const vorticity = particle_system.get_channel(particle_system.register_channel("vorticity", 3, ChannelLayout::SCRATCH));
 
-			}
+	// omega_i = sum_j m_j / rho_j gradW_ij x (v_j - v_i), gradW_ij - gradient of W(x_i - x_j) with respect to x_i
+	#pragma omp parallel for schedule(static)
+	for(int slot = 0; slot < no_particles; ++slot)
+	{
+		auto const & particle_i = particles[slot];
+		glm::vec3 omega(0.0f);
+		for(int n = offsets[slot]; n < offsets[slot + 1]; ++n)
+		{
+			auto const & particle_j = particles[neighbours[n].slot];
+			float const r = neighbours[n].r;
+			if(r <= 0.0f)
+				continue;
+
+			glm::vec3 const rVec = minimum_image(particle_i.position - particle_j.position);
+			glm::vec3 const gradW = kernel::GradW_spiky(r, kernel::symmetric(particle_i.h, particle_j.h))*rVec;
+			omega += particle_j.mass / particle_j.density * glm::cross(gradW, particle_j.velocity - particle_i.velocity);
 		}
+
+		vorticity[slot * 3 + 0] = omega.x;
+		vorticity[slot * 3 + 1] = omega.y;
+		vorticity[slot * 3 + 2] = omega.z;
 	}
 }
 
@@ -536,55 +967,38 @@ bool save_screenshot(std::string filename, int w, int h)
 	return true;
 }
 
-void Simulation::advance()
+void Simulation::update_moving_boundaries(float dt)
 {
-	auto static iteration_count = 0u;
-	auto static sim_time = 0.0f;
-	using namespace c;
-	using std::chrono::high_resolution_clock;
-	using std::chrono::milliseconds;
-	// http://stackoverflow.com/questions/16056300/runge-kutta-rk4-not-better-than-verlet?rq=1
-	glm::vec3 kinetic_force(0.0f), potential_force(0.0f);
-	auto & particles = particle_system.particles;
-	
-	#pragma omp parallel default(shared)
+	// transform at the start of this step - forces and collisions are evaluated there
+	for(auto & body : moving_boundaries)
 	{
-		#pragma omp for schedule(static)
-		//for (auto & p : particles)
-		for(int idx = 0; idx < particles.size(); ++idx)
+		if(body.update(sim_time, dt))
 		{
-			auto & p = particles[idx];
-			// 0. semi-implicit Euler
-			//glm::vec3 new_velocity = p.velocity + p.acc*dt;
-			//glm::vec3 new_position = p.position + new_velocity*dt;
-
-			// 1. velocity Verlet O(dt^3)
-			glm::vec3 new_position = p.position + p.velocity*dt + 0.5f*p.acc*dt*dt;
-			glm::vec3 new_velocity = (new_position - p.position) / dt;
-
-			// 2. position Verlet O(dt^4): http://www.saylor.org/site/wp-content/uploads/2011/06/MA221-6.1.pdf
-			//glm::vec3 new_position = 2.0f*p.position - p.previous_position + p.acc*dt*dt;// r_(t+dt)
-			//glm::vec3 new_velocity = (new_position - p.position)/dt;// v_(t+dt)
-
-			// 3. Leapfrog: http://einstein.drexel.edu/courses/Comp_Phys/Integrators/leapfrog/
-			//glm::vec3 half_velocity = p.velocity + p.acc*dt; // v(t+1/2) = v(t-1/2) + a(t)*dt
-			//glm::vec3 eval_velocity = (p.velocity + half_velocity)*0.5f; // v(t+1) = [v(t-1/2) + v(t+1/2)] * 0.5; used to compute forces later
-			//glm::vec3 new_velocity = half_velocity;// new_velocity = v(t+1/2)
-			//glm::vec3 new_position = p.position + half_velocity*dt; // p(t+1) = p(t) + v(t+1/2) dt
-
-			//p.previous_position = p.position;
-			p.position = new_position;
-			//p.eval_velocity = eval_velocity;
-			p.velocity = new_velocity;
-
-			potential_force += p.position * glm::abs(p.acc);
-			kinetic_force += glm::pow(new_velocity, glm::vec3(2.0f));
+			grid.cover_cells(body.get_previous_first_cell(), body.get_previous_last_cell(), -1);
+			grid.cover_cells(body.get_first_cell(), body.get_last_cell(), 1);
 		}
 	}
-	
+}
+
+void Simulation::advance()
+{
+	switch(integrator)
+	{
+	case c::SYMPLECTIC_EULER: advance_with<integrator::SymplecticEuler>(); break;
+	case c::VELOCITY_VERLET: advance_with<integrator::VelocityVerlet>(); break;
+	case c::LEAPFROG_KDK: advance_with<integrator::LeapfrogKDK>(); break;
+	case c::ADAMS_BASHFORTH_2: advance_with<integrator::AdamsBashforth2>(); break;
+	}
+
 	iteration_count++;
-	sim_time += dt;
-	mechanical_energy = 0.5f*c::particleMass*glm::length(kinetic_force) + c::particleMass*glm::length(potential_force);
+	sim_time += time_step;
+
+	// energies are reduced outside of the parallel loop above (deterministic block sums, see Diagnostics);
+	// of a consistent state also for staggered integrators (leapfrog velocities are half a step ahead)
+	auto const & report = diagnostics.compute(staggered_integrator ? synchronised_particles : particle_system.particles, particle_system.particle_count, grid.grid);
+	mechanical_energy = static_cast<float>(report.mechanical_energy());
+	if(c::diagnostics_report_interval != 0u && iteration_count % c::diagnostics_report_interval == 0u)
+		std::cout << report << std::endl;
 	//auto d = std::chrono::duration_cast<milliseconds>(high_resolution_clock::now() - start_time);
 	//if(iteration_count % 5u == 0)
 	//	energy_stats.push_back(std::make_pair(sim_time, static_cast<float>(iteration_count) / static_cast<float>(d.count())));
@@ -592,158 +1006,90 @@ void Simulation::advance()
 	//	save_screenshot(std::string("./../screenshot/screen_dt_" + std::to_string(sim_time) + ".tga"), c::width, c::height);
 }
 
-void Simulation::resolve_collisions()
+template<typename Integrator>
+void Simulation::advance_with()
 {
-	// coefficient of restitution:
-	// To cancel out the velocity in the normal direction we set cR = 0,
-	// which models the normally applied no-slip condition for a liquid,
-	// i.e. an inelastic collision, while models an elastic collision as in (4. 56)
-	static const float cR = 0.5f;
-	static const float particleBounceRadius = 0.05f;
-
-	auto const & walls_positions = bounding_box.surface_positions;
-	auto const & walls_normals = bounding_box.surface_normals;
-
-	for(auto & tp : particle_system.particles)
+	// http://stackoverflow.com/questions/16056300/runge-kutta-rk4-not-better-than-verlet?rq=1
+	using particle_system::wrap_position;
+	auto & particles = particle_system.particles;
+	auto const & near_wall_cells = grid.near_wall_cells;
+	float const dt = time_step;
+	int const no_history_components = Integrator::no_history_components;
+	float * const history = no_history_components == 0 ? nullptr : particle_system.get_channel(
+		particle_system.register_channel(std::string("integrator history: ") + Integrator::name(), no_history_components, ChannelLayout::SORTED));
+	staggered_integrator = Integrator::staggered;
+	if(Integrator::staggered)
+		synchronised_particles.resize(particle_system.particle_count);
+	
+	#pragma omp parallel default(shared)
 	{
-		for(unsigned j = 0; j < bounding_box.no_surfaces; ++j)
+		// walls: only particles binned in cells near a boundary (cost ~ wall area, not particle count)
+		#pragma omp for schedule(dynamic)
+		for(int k = 0; k < static_cast<int>(near_wall_cells.size()); ++k)
 		{
-			auto const & wall_position = walls_positions[j];
-			auto const & wall_normal = walls_normals[j];
-
-
-			// fluids method --------------------------------------------------
-			// c::H - particle radius
-			float simulation_scale = 1.0f;
-			float epsilon = 0.00001f;
-			float wall_particle_distance = c::H - fabs(dot(wall_position - tp.position, wall_normal)*simulation_scale);
+			auto const & cell = grid.grid[near_wall_cells[k]];
+			for(int idx = 0; idx < cell.no_particles; ++idx)
+				resolve_collision(cell.first_particle[idx]);
+		}
+		// implicit barrier - integration needs the wall response
 
-			if(wall_particle_distance > epsilon)
+		#pragma omp for schedule(static)
+		for(int idx = 0; idx < particle_system.particle_count; ++idx)
+		{
+			auto & p = particles[idx];
+			Integrator::step(p, history == nullptr ? nullptr : history + idx * no_history_components, dt);
+			if(Integrator::staggered)
 			{
-				float spring = c::wall_stiffness*wall_particle_distance + c::wall_damping*dot(wall_normal, tp.velocity);//eval_velocity
-				tp.acc += spring*wall_normal;
+				synchronised_particles[idx] = p;
+				Integrator::synchronise(synchronised_particles[idx], dt);
 			}
-
-			// ----------------------------------------------------------------
-
-
-			//float d = c::H;
-			//float dist2 = fabs(dot(wall_position - tp.position, wall_normal) + particleBounceRadius);
-
-			//// distance method:
-			//// http://sccg.sk/~durikovic/publications/Pub09_11_files/SCCG2010_SPH_Flood.pdf
-			//if(dist2 < d)//dist2 < d
-			//{
-			//	static const float c = 4.5f;
-
-			//	// if(tp.velocity*wallNormal < glm::vec3(0.0f))
-			//	tp.velocity += c*(2.0f*d - dist2)*wall_normal;
-			//}
-
-			//if(dist2 < 0.01f)// dist2 < 0.0f
-			//{
-				// 1.
-				// tp.acc() += c::wallStiffness * wallNormal * dist2;
-				// tp.acc() += c::wallDamping * dot(tp.position, wallNormal) * wallNormal;
-				// 2.
-				// float velNorm = glm::length(tp.velocity);//sqrt(dot(tp.velocity, tp.velocity));
-				// tp.position += fabs(dist2)*wall_normal;
-				// tp.velocity -= 2.0*dot(tp.velocity, wallNormal)*wallNormal;// kelager (4.56)
-				// tp.velocity -= (1.0 + cR)*dot(tp.velocity, wallNormal)*wallNormal;// kelager (4.57)
-				// tp.velocity -= (1.0f + cR*(fabs(dist2) / (c::dt*velNorm)))*dot(tp.velocity, wall_normal)*wall_normal;// kelager (4.58)
-
-				// 3.
-				// tp.velocity += fabs(dist2) * wallNormal / dt;
-
-				// tp.position = tp.position - tp.velocity*dt;
-
-				// 4.
-				// r_c - miejsce kolizji
-				// r_12 - obliczone poprzednie polozenie czastki (polozone 'za' przeszkoda)
-				// glm::vec3 r_c = tp.position;
-
-				// float velNorm = math::mag(tp.velocity);//sqrt(dot(tp.velocity, tp.velocity));
-
-				// float r_rc = dot(wallNormal, r_c);
-				// float r_r1 = dot(wallNormal, tp.posPrev());
-				// glm::vec3 r_12 = tp.posPrev() - (1.0f + cR)*(r_r1 - r_rc)*wallNormal;
-
-				// tp.position += wallNormal*fabs(dist2);
-				// tp.posPrev() = r_12;
-				// tp.velocity -= (1.0 + cR*(fabs(dist2)/(dt*velNorm)))*dot(tp.velocity, wallNormal)*wallNormal;//(1.0 + cR*(fabs(dist2)/(dt*velNorm)))
-
-				// jesli wykrylem kolizje to licze ja tylko dla jednej sciany
-				// fix zeby naprawic zrabane normalne scin w rogach
-				// break;
-			//}
+			p.position = dimension::pin(wrap_position(p.position));
+			p.velocity = dimension::pin(p.velocity);
 		}
 	}
 }
 
-float Simulation::W_poly6(float r_sq, float h_sq, float h)
+void Simulation::resolve_collision(Particle & tp) const
 {
-	static float coefficient = 315.0f / (64.0f*c::PIf*pow(h, 9));
-
-	return coefficient * pow(h_sq - r_sq, 3);
-}
-
-glm::vec3 Simulation::GradW_poly6(float r, float h)
-{
-	static float coefficient = -945.0f / (32.0f*c::PIf*pow(h, 9));
-
-	return glm::vec3(coefficient * pow(pow(h, 2) - pow(r, 2), 2));// * r
-}
-
-// do surface tension color field
-float Simulation::LapW_poly6(float r, float h)
-{
-	static float coefficient = -945.0f / (32.0f*c::PIf*pow(h, 9));
-
-	return coefficient * (pow(h, 2) - pow(r, 2)) * (3.0f*pow(h, 2) - 7.0f*pow(r, 2));
-}
-
-// float Simulation::W_spiky(float r, float h)
-// {
-// 	if(r <= 0 || r >= h)
-// 		return 0;
+	float const epsilon = 0.00001f;
+	float wall_distance;
+	glm::vec3 wall_normal;
+	boundary.sample(tp.position, wall_distance, wall_normal);
 
-// 	return 15.0/(M_PI*pow(h, 6)) * (pow(h - r, 3));
-// }
-
-glm::vec3 Simulation::GradW_spiky(float r, float h)
-{
-	static float coefficient = -45.0f / (c::PIf*pow(h, 6));
-
-	return glm::vec3(coefficient * pow((h - r), 2) / r);
-}
-
-// float Simulation::W_viscosity(float r, float h)
-// {
-// 	if(r <= 0 || r >= h)
-// 		return 0;
-
-// 	return 15.0/(2.0*M_PI*pow(h, 3)) * (-pow(r, 3)/(2.0*pow(h, 3)) + pow(r, 2)/pow(h, 2) + h/(2.0*r) - 1);
-// }
-
-float Simulation::LapW_viscosity(float r, float h)
-{
-	static float coefficient = 45.0f / (c::PIf*pow(h, 6));
+	if(c::boundary_handling == c::PENALTY_SDF)
+	{
+		// fluids method: penalty spring along the boundary normal when a particle is closer than c::H to a wall;
+		// one lookup in the boundary distance field per particle, no matter how many walls/obstacles there are
+		float const penetration = c::H - wall_distance;
+		if(penetration > epsilon)
+		{
+			float spring = c::wall_stiffness*penetration + c::wall_damping*dot(wall_normal, tp.velocity);
+			tp.acc += spring*wall_normal;
+		}
+	}
+	else if(wall_distance < 0.0f)
+	{
+		// boundary particles push back through pressure; this only catches particles
+		// which already got through: back onto the surface, without the inward normal velocity
+		tp.position -= wall_distance*wall_normal;
+		float const normal_velocity = dot(wall_normal, tp.velocity);
+		if(normal_velocity < 0.0f)
+			tp.velocity -= normal_velocity*wall_normal;
+	}
 
-	return coefficient * (h - r);
-}
+	// moving bodies are not sampled with boundary particles: always a spring, damped by the velocity relative to the wall
+	for(auto const & body : moving_boundaries)
+	{
+		float body_distance;
+		glm::vec3 body_normal, body_velocity;
+		if(!body.sample(tp.position, body_distance, body_normal, body_velocity))
+			continue;
 
-glm::vec3 Simulation::Grad_BicubicSpline(glm::vec3 x, float h)
-{
-	auto const r = glm::length(x);
-	auto const q = r / h;
-	auto coefficient = 6.0f * (8.0f/c::PIf) / pow(h, 3);
-
-	if(0.0f <= q && q <= 0.5f)
-		coefficient *= 3.0f * pow(q, 2) - 2.0f * q;
-	else if(0.5f < q && q <= 1.0f)
-		coefficient *= -1.0f * pow(1.0f - q, 2);
-	else
-		coefficient *= 0.0f;
-
-	return glm::vec3(coefficient) * glm::normalize(x) / h;
+		float const penetration = c::H - body_distance;
+		if(penetration > epsilon)
+		{
+			float spring = c::wall_stiffness*penetration + c::wall_damping*dot(body_normal, tp.velocity - body_velocity);
+			tp.acc += spring*body_normal;
+		}
+	}
 }
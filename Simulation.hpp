@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <memory>
 #include <chrono>
 #include <fstream>
 #include <sstream>
@@ -10,7 +11,19 @@
 #include "MCMesh.hpp"
 #include "Grid.hpp"
 #include "Box.hpp"
+#include "BoundarySDF.hpp"
+#include "BoundaryParticles.hpp"
+#include "MovingBoundary.hpp"
 #include "Emitters.hpp"
+#include "ReactionDiffusion.hpp"
+#include "ImplicitViscosity.hpp"
+#include "LoadBalancer.hpp"
+#include "NeighbourList.hpp"
+#include "Diagnostics.hpp"
+#include "Integrators.hpp"
+#include "Precision.hpp"
+#include "PositionCache.hpp"
+#include "DerivedFields.hpp"
 
 /**
  * Basicly main class where all computation takes place.
@@ -23,8 +36,21 @@
  * @param distance_field	Creator of 3D scalar field describing minimum distance towards (fluid) surface.
  * @param mesh	Generates a mesh by running standard Marching Cubes on previously detected surface particles.
  	Also saves mesh as OBJ.
- * @param bounding_box	Container kept here for easy access while painting and for colisions.
+ * @param bounding_box	Container kept here for easy access while painting.
+ * @param boundary	Signed distance field of container and obstacles; used for collisions.
+ * @param boundary_particles	Static particles on container and obstacle surfaces (c::BOUNDARY_PARTICLES mode).
+ * @param moving_boundaries	Kinematic obstacles (pistons, paddles...); transforms evaluated every step.
  * @param grid	Structure stores a 3D grid used for neighbour search optimization (see ParticleSystem).
+ 	Also keeps the list of cells near boundaries, the only ones visited by collision handling.
+ * @param reaction_diffusion	Species dissolved in the fluid (nutrients...); diffused and reacted in one neighbour pass.
+ * @param implicit_viscosity	Viscosity solve of c::IMPLICIT_VISCOSITY mode (see ImplicitViscosity).
+ * @param load_balancer	Distributes cell loops over threads by particle count (see LoadBalancer).
+ * @param diagnostics	Energies, momentum, max velocity/density error; thread-count independent.
+ * @param derived_fields	Consumers of derived per-particle fields (color field, surface flags, vorticity...);
+ 	a step computes only the fields some consumer reads on it (see DerivedFields).
+ * @param integrator	Time integrator of advance(); c::integrator unless changed (see Integrators.hpp).
+ * @param time_step	Length of a step [s]; run() advances the simulation by it.
+ 	Halved on blow-up, doubled back towards c::dt after c::recovery_steps healthy steps (see check_health()).
  */
 class Simulation
 {
@@ -32,53 +58,147 @@ public:
 	Simulation();
 	~Simulation();
 	
+	// dt - frame time; the simulation itself advances by time_step
 	void run(float dt);
+	// false after a blow-up which halving time_step down to c::min_time_step did not cure; run() does nothing then
+	bool is_healthy() const { return !gave_up; }
+	/**
+	 * Slots of particles at the free surface, ascending; for DistanceField and MCMesh.
+	 * Updated on steps with SURFACE_FLAGS wanted (see derived_fields), valid until the next sort step.
+	 */
+	std::vector<int> const & get_surface_slots() const { return surface_slots; }
+
+	/**
+	 * Runs the scene no_steps with every integrator, each from the same initial state, and writes
+	 * CPU time and relative change of mechanical energy (drift; includes physical dissipation,
+	 * so compare integrators with each other) to os. Creates its own Simulations:
+	 * call it before any other Simulation exists (particle ids restart from 0).
+	 */
+	static void benchmark_integrators(std::ostream & os, unsigned const no_steps);
+	/**
+	 * Runs the scene no_steps, then evaluates the kernels over its neighbour pairs with every math_tier
+	 * and writes time per pair and the error of each tier against math_tier::Exact to os
+	 * (max and root mean square, relative to the largest exact value). Creates its own Simulation,
+	 * so the same restriction as for benchmark_integrators() applies.
+	 */
+	static void report_math_tiers(std::ostream & os, unsigned const no_steps);
 
 	// main components and also Paintables
 	Skybox skybox;
 	ParticleSystem particle_system;
 	Emitters emitters;
+	ReactionDiffusion reaction_diffusion;
+	ImplicitViscosity implicit_viscosity;
 	DistanceField distance_field;
 	MCMesh mesh;
 	Box bounding_box;
+	BoundarySDF boundary;
+	BoundaryParticles boundary_particles;
+	std::vector<MovingBoundary> moving_boundaries;
 	Grid grid;
+	LoadBalancer load_balancer;
+	Diagnostics diagnostics;
+	DerivedFields derived_fields;
+
+	c::IntegratorType integrator;
+	float time_step;
 
 private:
+	/**
+	 * State to roll back to. Moving boundaries are not saved: they follow sim_time.
+	 * Neighbour list, densities of walls etc. are recomputed by the next step.
+	 */
+	struct Snapshot
+	{
+		ParticleSystemState particles;
+		Emitters emitters;
+		float sim_time;
+		unsigned iteration_count;
+	};
+
+	// every c::snapshot_interval iterations (and when there is none), overwriting the oldest one
+	void save_snapshot();
+	/**
+	 * Checks the last diagnostics report: no invalid particle, none moving farther than
+	 * c::max_particle_travel * c::H per step, density error within c::max_density_error.
+	 * On failure rolls back (consecutive failures - to older snapshots) and halves time_step.
+	 * @return	false if the step was undone
+	 */
+	bool check_health();
+
 	/**
 	* Assigns a bin index in 3D grid to every particle.
 	* This method is kept here because of interdependence of grid and particle_system:
 	* grid is kept in Grid structure and all particles are stored in ParticleSystem.
+	* Also computes prefix sums of particles per cell and repartitions cell loops.
 	*/
 	void bin_particles_in_grid();
 
-	/**
-	 * extract_surface_particles(), extract_surface_particles_2():
-	 * Temporary solution. Extracts surface particles. Used for ray casting.
-	 */
-	std::vector<Particle> extract_surface_particles();
-	std::vector<Particle> extract_surface_particles_2();
+	// curl of velocity into the "vorticity" channel (SCRATCH, 3 components), over neighbour_list; VORTICITY
+	void compute_vorticity();
 
 	void emit_particles();
-	void compute_nutrient_concentration();
+	// moves kinematic obstacles to the current time; patches Grid::near_wall_cells if they crossed cell borders
+	void update_moving_boundaries(float dt);
+	/**
+	 * Diffuses and reacts all species of reaction_diffusion over neighbour_list
+	 * (pair weights computed once, shared by every sub-step or solver sweep).
+	 */
+	void compute_reaction_diffusion();
+	// also fills neighbour_list; pair terms and sums over neighbours in c::precision (see Precision.hpp)
 	void compute_density();
+	template<typename Precision>
+	void compute_density_with();
+	/**
+	 * c::adaptive_resolution, every c::adaptivity_interval iterations: merges pairs of equal-mass bulk
+	 * particles (up to c::max_coarsening_level) and splits surface particles (down to c::max_refinement_level, see constants), over the neighbour_list of the step.
+	 * Mass and momentum are conserved exactly; h follows mass, c::H * (mass / c::particleMass)^(1/D) (see dimension::Traits::h_scale).
+	 */
+	void adapt_resolution();
+	/**
+	 * Viscosity only in c::EXPLICIT_VISCOSITY mode, color field only when COLOR_FIELD is wanted.
+	 * SURFACE_FLAGS steps: also sets Particle::at_surface from the cells it traverses anyway
+	 * (distance to the centre of mass of the particles there, their count) and fills surface_slots.
+	 */
 	void compute_forces();
+	template<typename Precision>
+	void compute_forces_with();
+	// c::IMPLICIT_VISCOSITY: adds the viscous acceleration solved by implicit_viscosity over neighbour_list
+	void compute_implicit_viscosity();
+	// integrates particles with the chosen integrator; walls are resolved first, in the same parallel region (see resolve_collision)
 	void advance();
-	void resolve_collisions();
+	template<typename Integrator>
+	void advance_with();
+	// wall response of a single particle; called only for particles in Grid::near_wall_cells
+	void resolve_collision(Particle & particle) const;
 
-	float W_poly6(float r_sq, float h_sq, float h);
-	glm::vec3 GradW_poly6(float r, float h);
-	float LapW_poly6(float r, float h);
-	//float W_spiky(float r, float h);
-	glm::vec3 GradW_spiky(float r, float h);
-	//float W_viscosity(float r, float h);
-	float LapW_viscosity(float r, float h);
-	glm::vec3 Grad_BicubicSpline(glm::vec3 x, float h);
+	PositionCache position_cache;// c::position_cache only; positions of the current step, built after binning
+	NeighbourList neighbour_list;// fluid neighbours of the current step (see compute_density())
+	std::vector<float> diffusion_weights;// per pair of neighbour_list: m_j / (rho_i + rho_j) * LapW_viscosity
+	std::vector<float> viscosity_weights;// per pair of neighbour_list, see compute_implicit_viscosity()
+	std::vector<float> boundary_viscosity_weights;// per slot, c::BOUNDARY_PARTICLES only
+	std::vector<int> surface_slots;// see get_surface_slots()
+	std::vector<Particle> synchronised_particles;// advance_with(): state at the start of the step, staggered integrators only
+	std::vector<char> adapted;// per slot, adapt_resolution(): already merged or split in this pass
+	std::vector<float> adaptivity_indicators;// per slot, adapt_resolution(): surface indicator at the start of the pass
 
 	int particle_count;
+	unsigned iteration_count;
+	float sim_time;
 	float mechanical_energy;
 	std::chrono::high_resolution_clock::time_point start_time;
 	std::vector<std::pair<float, float> > energy_stats;
 	std::ofstream stats_file;
+	std::unique_ptr<StateHashLog> state_hash_log;// only in c::deterministic mode
+
+	std::vector<Snapshot> snapshots;// ring of c::no_snapshots; newest at newest_snapshot
+	int newest_snapshot;
+	int no_snapshots;// valid ones, counted back from newest_snapshot
+	int no_rollbacks;// since the last snapshot taken in a healthy run
+	unsigned healthy_steps;// since the last rollback or time step change
+	bool gave_up;
+	unsigned wanted_fields;// DerivedField bits of the current step
+	bool staggered_integrator;// of the last advance(); diagnostics then use synchronised_particles
 };
 
 // only for stats output
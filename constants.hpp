@@ -3,6 +3,9 @@
 //simulation constans
 namespace c
 {
+	// 3, or 2 for cheap parameter sweeps: particles in the z = 0 plane, one cell layer along z (see dimension::Traits)
+	auto constexpr dimensions = 3;
+
 	// "The larger the timestep, the smaller the smoothing kernel and the higher the stiffness,
 	// the more likely the system is to explode."
 
@@ -10,15 +13,22 @@ namespace c
 	const float H                = 0.03125f;//def = 0.03125f
 	const float gasStiffness     = 4.5f;// incompressibility can only be obtained as k -> infinity.
 	const float restDensity      = 100.0f;//115.f
-	const float particleMass     = 0.0008f;
+	const float particleMass     = dimensions == 3 ? 0.0008f : 0.04f;// 2D: mass per unit of depth, restDensity * spacing^2
 	const float viscosity        = 1.5f;//0.005f; def = 1.5f
 	const float surfaceTension   = 0.45f;
 	const float surfaceThreshold = 0.00001f;
 	const float gravityAcc       = -9.80665f;
 
-	// for collisions with container (Box)
+	// for collisions with container (Box) and obstacles (see BoundarySDF)
 	const float wall_stiffness = 50000.0f;// im mniejsza tym sciany bardziej 'faluja'
 	const float wall_damping = -100.0f;
+	const float sdf_spacing = H * 0.25f;// boundary distance field lattice spacing
+
+	// PENALTY_SDF - springs from the distance field (stiffness limits dt),
+	// BOUNDARY_PARTICLES - walls sampled with static particles taking part in density and pressure
+	enum BoundaryHandling { PENALTY_SDF, BOUNDARY_PARTICLES };
+	auto const boundary_handling = BOUNDARY_PARTICLES;
+	const float boundary_particle_spacing = H * 0.5f;
 
 	// viewport dimensions
 	const int width = 1024;
@@ -37,18 +47,18 @@ namespace c
  * grid constants:
  * N			init (not total!) number of particles
  * [K, L, M]	count of bins in X, Y, Z dimensions; defines number of grid bins.
- *				set only as power of 2 (other values causes round-off errors)
+ *				set only as power of 2 (other values causes round-off errors); M = 1 in 2D
  * [xmin, xmax]	dimensions of neighbour grid (in world coordinates).
  *				best to keep those min/max constants with opposite signs
  * dx, dy, dz	dimensions of single bin. only power of 2
  */
 namespace c
 {
-	const int N = 2000; // Simulation::particle count; def = 8000
-	const int K = 16, L = 8, M = 16;// tylko potegi 2 (bo powstaja niedokladnosci przy dzieleniu m.in. przy dx/dy/dz)
+	const int N = dimensions == 3 ? 2000 : 104; // Simulation::particle count; def = 8000; 2D: one layer of the dam break block
+	const int K = 16, L = 8, M = dimensions == 3 ? 16 : 1;// tylko potegi 2 (bo powstaja niedokladnosci przy dzieleniu m.in. przy dx/dy/dz)
 	const int C = K*L*M;
-	const float xmin = -0.25f, ymin = -0.125f, zmin = -0.25f;
-	const float xmax = 0.25f, ymax = 0.125f, zmax = 0.25f;
+	const float xmin = -0.25f, ymin = -0.125f, zmin = dimensions == 3 ? -0.25f : -0.5f*H;
+	const float xmax = 0.25f, ymax = 0.125f, zmax = dimensions == 3 ? 0.25f : 0.5f*H;
 	const float dx = (xmax - xmin) / static_cast<float>(K);// tez tylko potegi 2, np. 2^(-6)=1/64
 	const float dy = (ymax - ymin) / static_cast<float>(L);
 	const float dz = (zmax - zmin) / static_cast<float>(M);
@@ -57,7 +67,6 @@ namespace c
 // rendering constants
 namespace c
 {
-	auto const surfaceParticleGradientThreshold = 1.0f;// threshold for 2. surface-particle-search method
 	auto const centerMassThreshold = 0.004f;
 	auto const surfaceNeighbourhoodThreshold = 16u;
 	auto const voxelGridDimension = 64;
@@ -81,4 +90,117 @@ namespace c
 {
 	auto constexpr nutrient_diffusion = 0.1f;
 	auto constexpr nutrient_consumption_rate = 0.0f;
-}
\ No newline at end of file
+	auto constexpr reaction_time_scale = 0.2f;// species change this much slower than the flow (ReactionDiffusion::step)
+	auto constexpr max_species = 8;// per-particle accumulators of ReactionDiffusion live on the stack
+
+	// see ReactionDiffusion::step()
+	enum DiffusionSolver { EXPLICIT_SUBCYCLED, IMPLICIT_JACOBI, LATTICE };
+	auto const diffusion_solver = EXPLICIT_SUBCYCLED;
+	auto constexpr diffusion_stability_limit = 1.0f;// explicit sub-step * diffusion * max row weight sum; up to 1 no overshoot, above 2 unstable
+	auto constexpr diffusion_jacobi_iterations = 8;
+	auto constexpr diffusion_lattice_subdivision = 2;// LATTICE: nodes per Grid cell and axis (see DiffusionLattice)
+}
+
+// time integration (see Integrators.hpp)
+namespace c
+{
+	enum IntegratorType { SYMPLECTIC_EULER, VELOCITY_VERLET, LEAPFROG_KDK, ADAMS_BASHFORTH_2 };
+	auto const integrator = VELOCITY_VERLET;
+	auto constexpr integrator_benchmark_steps = 0u;// > 0 - main() compares all integrators over this many steps first (see Simulation::benchmark_integrators)
+}
+
+// viscosity (see Simulation::compute_forces, ImplicitViscosity)
+namespace c
+{
+	// EXPLICIT_VISCOSITY - part of the force pass, dt < ~ restDensity * H^2 / viscosity;
+	// IMPLICIT_VISCOSITY - backward Euler solve after the force pass, any viscosity at the pressure-limited dt
+	// (scalar pair term, not the per-component one of EXPLICIT_VISCOSITY, see Simulation::compute_implicit_viscosity)
+	enum ViscositySolver { EXPLICIT_VISCOSITY, IMPLICIT_VISCOSITY };
+	auto const viscosity_solver = EXPLICIT_VISCOSITY;
+	auto constexpr viscosity_cg_max_iterations = 50;
+	auto constexpr viscosity_cg_tolerance = 1e-4f;// relative (preconditioned) residual, per velocity component
+}
+
+// precision of the neighbour passes (see Precision.hpp, PositionCache)
+namespace c
+{
+	// SINGLE_PRECISION - float everywhere; MIXED_PRECISION - float storage and pair terms, double sums over neighbours;
+	// DOUBLE_PRECISION - float storage, double pair terms and sums
+	enum PrecisionPolicy { SINGLE_PRECISION, MIXED_PRECISION, DOUBLE_PRECISION };
+	auto const precision = SINGLE_PRECISION;
+	auto constexpr position_cache = false;// true - candidates culled on 16-bit cell-relative positions before the exact test
+}
+
+// per-pair arithmetic of kernels and neighbour loops (see MathTier.hpp)
+namespace c
+{
+	// EXACT_MATH - IEEE sqrt and pow; NEWTON_RSQRT_MATH - rsqrt estimate + one Newton step, powers multiplied out;
+	// APPROXIMATE_MATH - bare rsqrt estimate (~12 bits)
+	enum MathTier { EXACT_MATH, NEWTON_RSQRT_MATH, APPROXIMATE_MATH };
+	auto const math_tier = EXACT_MATH;
+	auto constexpr math_tier_report_steps = 0u;// > 0 - main() reports errors of all tiers after this many steps first (see Simulation::report_math_tiers)
+}
+
+// adaptive resolution (see Simulation::adapt_resolution)
+namespace c
+{
+	// particles near the free surface are split in two (half mass, h / 2^(1/D)), pairs in the bulk merged into one
+	// (twice the mass, h * 2^(1/D)), also above the seeded particleMass;
+	// surface indicator: |color field gradient| * h, dimensionless (~0.7 median, ~1.2 top tenth in the default scene)
+	auto constexpr adaptive_resolution = false;
+	auto constexpr adaptivity_interval = 10u;// in iterations
+	auto constexpr max_refinement_level = 0;// lightest particle: particleMass / 2^level; 0 - the surface keeps the seeded resolution
+	auto constexpr max_coarsening_level = 3;// heaviest particle: particleMass * 2^level
+	auto constexpr split_indicator = 0.9f;
+	auto constexpr merge_indicator = 0.3f;
+	auto constexpr split_separation = 0.3f;// each daughter moves this many of its h away from the parent position
+	auto constexpr merge_radius = 0.5f;// in h; only particles of equal mass merge
+}
+
+// blow-up recovery (see Simulation::check_health)
+namespace c
+{
+	auto constexpr no_snapshots = 3;// ring of saved states; consecutive failures roll back to older ones
+	auto constexpr snapshot_interval = 50u;// in iterations
+	auto constexpr max_particle_travel = 1.0f;// per step, in kernel radii; farther - neighbours are skipped
+	auto constexpr max_density_error = 5.0f;// relative, see DiagnosticsReport::max_density_error
+	auto const min_time_step = dt / 64.0f;// halving below it - gives up (run() does nothing)
+	auto constexpr recovery_steps = 100u;// healthy steps before time step is doubled back towards dt
+}
+
+// load balancing of cell loops (see LoadBalancer)
+namespace c
+{
+	auto constexpr chunks_per_thread = 8;// more chunks - finer stealing granularity, more scheduling overhead
+	auto constexpr utilisation_report_interval = 0u;// in iterations; 0 - no report
+}
+
+// diagnostics (see Diagnostics)
+namespace c
+{
+	auto constexpr diagnostics_block_size = 256;// fixed, so reductions do not depend on thread count
+	auto constexpr histogram_bins = 16;// particles-per-cell histogram; last bin collects the rest
+	auto constexpr diagnostics_report_interval = 0u;// in iterations; 0 - no report
+}
+
+// reproducibility (see rng, StateHashLog)
+namespace c
+{
+	// true: fixed seed, particles with equal cell index sorted by Particle::id and state hashes
+	// logged (and compared with golden_state_hashes.txt if present) every state_hash_interval iterations
+	auto constexpr deterministic = false;
+	auto constexpr random_seed = 20170305ull;
+	auto constexpr state_hash_interval = 100u;
+	auto const state_hash_log_path = "state_hashes.txt";
+	auto const golden_state_hash_path = "golden_state_hashes.txt";
+}
+
+// periodic boundaries (see particle_system::wrap_position)
+namespace c
+{
+	// per axis: particles leaving the grid enter it on the opposite side, neighbours are searched across
+	// and container walls are removed; periodic axis needs at least 3 cells
+	auto constexpr periodic_x = false;
+	auto constexpr periodic_y = false;
+	auto constexpr periodic_z = false;
+}
@@ -12,6 +12,7 @@
 
 // My includes
 #include "Application.hpp"
+#include "Random.hpp"
 
 // Function prototypes
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
@@ -35,7 +36,7 @@ unique_ptr<Application> app;
 // The MAIN function, from here we start our application and run our Game loop
 int main(int argc, char* argv[])
 {
-	srand(static_cast<unsigned>(time(0)));
+	srand(static_cast<unsigned>(rng::session_seed()));
 
 	// Init GLFW
 	glfwInit();
@@ -73,6 +74,11 @@ int main(int argc, char* argv[])
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	//glCullFace(GL_FRONT_AND_BACK);
 
+	if(c::integrator_benchmark_steps != 0u)
+		Simulation::benchmark_integrators(std::cout, c::integrator_benchmark_steps);
+	if(c::math_tier_report_steps != 0u)
+		Simulation::report_math_tiers(std::cout, c::math_tier_report_steps);
+
 	app = make_unique<Application>();
 	double t0 = glfwGetTime();
 	double dt, fps;